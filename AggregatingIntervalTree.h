@@ -0,0 +1,265 @@
+#pragma once
+
+#include "IntervalTree.h"
+
+/**
+ * Monoids for AggregatingIntervalTree. Each provides an aggregate value_type, identity(), lift() turning a stored value
+ * into an aggregate, and combine(), which must be associative and commutative with identity() as neutral element.
+ */
+template<typename V>
+struct SumMonoid {
+    using value_type = V;
+    value_type identity() const { return value_type(); }
+    value_type lift(const V &value) const { return value; }
+    value_type combine(const value_type &a, const value_type &b) const { return a + b; }
+};
+
+template<typename V>
+struct CountMonoid {
+    using value_type = size_t;
+    value_type identity() const { return 0; }
+    value_type lift(const V &) const { return 1; }
+    value_type combine(const value_type &a, const value_type &b) const { return a + b; }
+};
+
+template<typename V>
+struct MinMonoid {
+    using value_type = V;
+    value_type identity() const { return std::numeric_limits<V>::max(); }
+    value_type lift(const V &value) const { return value; }
+    value_type combine(const value_type &a, const value_type &b) const { return std::min(a, b); }
+};
+
+template<typename V>
+struct MaxMonoid {
+    using value_type = V;
+    value_type identity() const { return std::numeric_limits<V>::lowest(); }
+    value_type lift(const V &value) const { return value; }
+    value_type combine(const value_type &a, const value_type &b) const { return std::max(a, b); }
+};
+
+/**
+ * An interval tree that folds the values of all intervals containing a point, or overlapping a query interval,
+ * without enumerating them. The intervals are held by an IntervalTree, whose layout, split rule and handling of empty
+ * intervals carry over unchanged. Alongside each of its nodes, prefix aggregates over the center list sorted by start
+ * and suffix aggregates over the one sorted by end let a point query combine one precomputed entry per level in
+ * O(log^2 n).
+ * Intervals are inclusive on the left, exclusive on the right, with the same query semantics as IntervalTree.
+ * @tparam T floating point type used by intervals
+ * @tparam V stored value type
+ * @tparam Monoid aggregation over V, such as SumMonoid<V>, CountMonoid<V>, MinMonoid<V> or MaxMonoid<V>
+ */
+template<typename T, typename V, typename Monoid>
+class AggregatingIntervalTree {
+public:
+    using aggregate_type = typename Monoid::value_type;
+
+    explicit AggregatingIntervalTree(Monoid monoid = Monoid()) : monoid_(monoid) {}
+
+    template<typename ForwardIt>
+    AggregatingIntervalTree(ForwardIt begin, ForwardIt end, Monoid monoid = Monoid(), BuildPolicy policy = BuildPolicy::Auto);
+
+    /**
+     * Compute the tree with the given list of interval-value pairs.
+     * @param intervals a collection of interval-value pairs where each `Interval(a, b)` represents the half-open interval [a, b).
+     * Pairs with b <= a contain no points and never contribute to an aggregate.
+     * @param policy how to lay out the intervals, as for IntervalTree::build()
+     */
+    template<typename ForwardIt>
+    void build(ForwardIt begin, ForwardIt end, BuildPolicy policy = BuildPolicy::Auto);
+
+    /**
+     * Insert a single new value at the given interval. Like IntervalTree::insert(), this does not rebalance; it also
+     * recomputes every aggregate, so it takes linear time, and many intervals are better added with build().
+     * @param interval new interval
+     * @param value value to store at the new interval
+     */
+    void insert(const Interval<T> &interval, const V &value);
+
+    /**
+     * Combine the values of all intervals containing the query point, i.e. those with a <= val < b
+     * @param val query point
+     * @return identity() if no interval contains val
+     */
+    aggregate_type aggregate(T val) const;
+
+    /**
+     * Combine the values of all intervals overlapping with the query interval
+     * @param interval
+     */
+    aggregate_type aggregate(const Interval<T> &interval) const;
+
+    size_t size() const;
+
+    /**
+     * Describe the layout of the underlying IntervalTree
+     */
+    IntervalTreeStats stats() const;
+
+    typename std::vector<std::pair<Interval<T>, V>>::const_iterator cbegin() const;
+    typename std::vector<std::pair<Interval<T>, V>>::const_iterator cend() const;
+
+    /**
+     * Clears all data and resets the tree
+     */
+    void clear();
+
+private:
+    using TreeNode = typename IntervalTree<T, V>::TreeNode;
+
+    /** aggregates kept for one node of tree_, stored in preorder */
+    struct NodeAggregates {
+        /** prefix[i] combines the first i entries by start, suffix[i] the entries by end from position i on */
+        std::vector<aggregate_type> prefix;
+        std::vector<aggregate_type> suffix;
+        /** position of the right child's aggregates, which follow those of the whole left subtree */
+        size_t right = 0;
+    };
+
+    /** recompute the node aggregates and the segment tree over the start order */
+    void update_aggregates();
+
+    /** append the aggregates of the subtree rooted at node in preorder */
+    void build_node_aggregates(const TreeNode &node);
+
+    Monoid monoid_;
+    IntervalTree<T, V> tree_;
+    std::vector<NodeAggregates> node_aggregates_;
+    /** segment tree of the aggregates of tree_'s start order, with leaves at [n, 2n) */
+    std::vector<aggregate_type> start_tree_;
+};
+
+/* Definitions */
+
+template<typename T, typename V, typename Monoid>
+template<typename ForwardIt>
+AggregatingIntervalTree<T, V, Monoid>::AggregatingIntervalTree(ForwardIt begin, ForwardIt end, Monoid monoid,
+                                                               BuildPolicy policy) : monoid_(monoid) {
+    build(begin, end, policy);
+}
+
+template<typename T, typename V, typename Monoid>
+template<typename ForwardIt>
+void AggregatingIntervalTree<T, V, Monoid>::build(ForwardIt begin, ForwardIt end, BuildPolicy policy) {
+    tree_.build(begin, end, policy);
+    update_aggregates();
+}
+
+template<typename T, typename V, typename Monoid>
+void AggregatingIntervalTree<T, V, Monoid>::insert(const Interval<T> &interval, const V &value) {
+    tree_.insert(interval, value);
+    update_aggregates();
+}
+
+template<typename T, typename V, typename Monoid>
+void AggregatingIntervalTree<T, V, Monoid>::update_aggregates() {
+    node_aggregates_.clear();
+    if (tree_.root_) {
+        build_node_aggregates(*tree_.root_);
+    }
+    const auto &by_start = tree_.index_sorted_by_start_;
+    size_t n = by_start.size();
+    start_tree_.assign(2 * n, monoid_.identity());
+    for (size_t i = 0; i < n; i++) {
+        start_tree_[n + i] = monoid_.lift(tree_.intervals_[by_start[i]].second);
+    }
+    for (size_t i = n; i-- > 1;) {
+        start_tree_[i] = monoid_.combine(start_tree_[2 * i], start_tree_[2 * i + 1]);
+    }
+}
+
+template<typename T, typename V, typename Monoid>
+void AggregatingIntervalTree<T, V, Monoid>::build_node_aggregates(const TreeNode &node) {
+    const auto &intervals = tree_.intervals_;
+    size_t n = node.center_size();
+    NodeAggregates aggregates;
+    aggregates.prefix.assign(n + 1, monoid_.identity());
+    aggregates.suffix.assign(n + 1, monoid_.identity());
+    for (size_t i = 0; i < n; i++) {
+        aggregates.prefix[i + 1] = monoid_.combine(aggregates.prefix[i], monoid_.lift(intervals[node.sorted_by_start()[i]].second));
+    }
+    for (size_t i = n; i > 0; i--) {
+        aggregates.suffix[i - 1] = monoid_.combine(aggregates.suffix[i], monoid_.lift(intervals[node.sorted_by_end()[i - 1]].second));
+    }
+    //the children are appended after this node, so it is only addressed by position from here on
+    size_t pos = node_aggregates_.size();
+    node_aggregates_.push_back(std::move(aggregates));
+    if (node.left_) {
+        build_node_aggregates(*node.left_);
+    }
+    node_aggregates_[pos].right = node_aggregates_.size();
+    if (node.right_) {
+        build_node_aggregates(*node.right_);
+    }
+}
+
+template<typename T, typename V, typename Monoid>
+typename AggregatingIntervalTree<T, V, Monoid>::aggregate_type AggregatingIntervalTree<T, V, Monoid>::aggregate(T val) const {
+    aggregate_type result = monoid_.identity();
+    if (!tree_.root_) {
+        //the flat layouts have no nodes to keep aggregates for, and few hits or few intervals to combine
+        auto fold = [&](size_t i) { result = monoid_.combine(result, monoid_.lift(tree_.intervals_[i].second)); };
+        tree_.visit(val, fold);
+        return result;
+    }
+    size_t pos = 0;
+    for (const TreeNode *node = tree_.root_.get(); node;) {
+        const NodeAggregates &aggregates = node_aggregates_[pos];
+        if (val <= node->x_center_) {
+            //as in TreeNode::step(), the hits are exactly those starting at or before val
+            result = monoid_.combine(result, aggregates.prefix[node->count_starts_up_to(val)]);
+            node = node->left_.get();
+            pos++;
+        } else {
+            //and here exactly those ending after val
+            result = monoid_.combine(result, aggregates.suffix[node->center_size() - node->count_ends_after(val)]);
+            node = node->right_.get();
+            pos = aggregates.right;
+        }
+    }
+    return result;
+}
+
+template<typename T, typename V, typename Monoid>
+typename AggregatingIntervalTree<T, V, Monoid>::aggregate_type AggregatingIntervalTree<T, V, Monoid>::aggregate(const Interval<T> &interval) const {
+    //intervals enclosing the query start, plus the disjoint set of those starting strictly inside the query interval,
+    //which form a contiguous range of the start order
+    aggregate_type result = aggregate(interval.start);
+    size_t n = tree_.index_sorted_by_start_.size();
+    size_t l = tree_.template start_bound<true>(interval.start);
+    size_t r = std::max(l, tree_.template start_bound<false>(interval.end));
+    for (l += n, r += n; l < r; l /= 2, r /= 2) {
+        if (l & 1) result = monoid_.combine(result, start_tree_[l++]);
+        if (r & 1) result = monoid_.combine(result, start_tree_[--r]);
+    }
+    return result;
+}
+
+template<typename T, typename V, typename Monoid>
+size_t AggregatingIntervalTree<T, V, Monoid>::size() const {
+    return tree_.size();
+}
+
+template<typename T, typename V, typename Monoid>
+IntervalTreeStats AggregatingIntervalTree<T, V, Monoid>::stats() const {
+    return tree_.stats();
+}
+
+template<typename T, typename V, typename Monoid>
+void AggregatingIntervalTree<T, V, Monoid>::clear() {
+    tree_.clear();
+    node_aggregates_.clear();
+    start_tree_.clear();
+}
+
+template<typename T, typename V, typename Monoid>
+typename std::vector<std::pair<Interval<T>, V>>::const_iterator
+AggregatingIntervalTree<T, V, Monoid>::cbegin() const {
+    return tree_.cbegin();
+}
+
+template<typename T, typename V, typename Monoid>
+typename std::vector<std::pair<Interval<T>, V>>::const_iterator
+AggregatingIntervalTree<T, V, Monoid>::cend() const {
+    return tree_.cend();
+}
@@ -0,0 +1,387 @@
+#pragma once
+
+#include "IntervalTree.h"
+#include <cstring>
+
+/**
+ * An immutable interval tree for very large collections, storing the endpoints in compressed form.
+ * The intervals are sorted by start and cut into blocks of block_size. A header per block keeps its smallest and
+ * largest start and its largest end; the block itself holds the gaps between consecutive starts and the lengths of the
+ * intervals, each packed with the fewest bits that fit the largest value in the block. Queries skip blocks by their
+ * headers, descending a max-tree over the block ends so that a point query only visits blocks holding a hit, and
+ * decode just the blocks they touch. Values are kept in start order, so no indices are stored.
+ * Endpoints are mapped to unsigned integers of the same order, so integral and floating point endpoints are both stored
+ * exactly; floating point endpoints must not be NaN, and -0 is returned as +0. Intervals are inclusive on the left,
+ * exclusive on the right, as in IntervalTree; pairs with b <= a contain no points, so they are dropped.
+ * @tparam T arithmetic type of at most 64 bits used by intervals
+ * @tparam V stored value type
+ */
+template<typename T, typename V>
+class CompressedIntervalTree {
+    static_assert(std::is_arithmetic<T>::value && !std::is_same<T, bool>::value && sizeof(T) <= 8,
+                  "CompressedIntervalTree needs integral or floating point endpoints of at most 64 bits");
+public:
+    /** number of intervals per block */
+    static constexpr size_t block_size = 128;
+
+    CompressedIntervalTree() = default;
+
+    template<typename ForwardIt>
+    CompressedIntervalTree(ForwardIt begin, ForwardIt end);
+
+    /**
+     * Compute the tree with the given range of interval-value pairs, replacing the previous contents; each
+     * `Interval(a, b)` represents the half-open interval [a, b).
+     */
+    template<typename ForwardIt>
+    void build(ForwardIt begin, ForwardIt end);
+
+    /**
+     * Number of intervals containing the query point, i.e. those with a <= val < b
+     * @param val query point
+     */
+    size_t count(T val) const;
+
+    /**
+     * Call f(const Interval<T> &interval, const V &value) for each interval containing the query point
+     * @param val query point
+     */
+    template<typename F>
+    void query(T val, F f) const;
+
+    /**
+     * Call f(const Interval<T> &interval, const V &value) once for each interval overlapping the query interval, with
+     * the same semantics as IntervalTree::query(const Interval<T> &), except that the dropped pairs are never returned
+     * @param interval
+     */
+    template<typename F>
+    void query(const Interval<T> &interval, F f) const;
+
+    /** number of stored intervals, not counting the dropped ones */
+    size_t size() const;
+
+    /** bytes of heap memory held by the tree */
+    size_t memory_usage() const;
+
+    /**
+     * Clears all data
+     */
+    void clear();
+
+private:
+    /** unsigned integer type of the encoded endpoints */
+    using key_type = typename std::conditional<(sizeof(T) > 4), uint64_t, uint32_t>::type;
+
+    struct Block {
+        key_type first_start;
+        key_type last_start;
+        key_type max_end;
+        /** the lengths are stored as their difference from the block's shortest length */
+        key_type min_length;
+        /** position of the packed gaps and lengths in bits_, in bits */
+        size_t offset;
+        uint8_t start_width;
+        uint8_t length_width;
+    };
+
+    /** key with the same order as the endpoint value */
+    static key_type encode(T value) {
+        return encode(value, std::is_floating_point<T>());
+    }
+
+    static key_type encode(T value, std::false_type) {
+        using unsigned_type = typename std::make_unsigned<T>::type;
+        //flipping the sign bit moves the negative values below the non-negative ones
+        return static_cast<key_type>(static_cast<unsigned_type>(static_cast<unsigned_type>(value) ^ sign_bit<unsigned_type>()));
+    }
+
+    static key_type encode(T value, std::true_type) {
+        using bits_type = typename std::conditional<sizeof(T) == 8, uint64_t, uint32_t>::type;
+        //-0 and +0 compare equal, so they need the same key
+        if (value == T(0)) value = T(0);
+        bits_type bits;
+        std::memcpy(&bits, &value, sizeof(T));
+        //negative values order by decreasing magnitude, so all their bits are flipped
+        return static_cast<key_type>(bits & sign_bit<bits_type>() ? ~bits : bits | sign_bit<bits_type>());
+    }
+
+    /** the endpoint value of a key */
+    static T decode(key_type key) {
+        return decode(key, std::is_floating_point<T>());
+    }
+
+    static T decode(key_type key, std::false_type) {
+        using unsigned_type = typename std::make_unsigned<T>::type;
+        return static_cast<T>(static_cast<unsigned_type>(static_cast<unsigned_type>(key) ^ sign_bit<unsigned_type>()));
+    }
+
+    static T decode(key_type key, std::true_type) {
+        using bits_type = typename std::conditional<sizeof(T) == 8, uint64_t, uint32_t>::type;
+        bits_type bits = static_cast<bits_type>(key);
+        bits = bits & sign_bit<bits_type>() ? static_cast<bits_type>(bits & ~sign_bit<bits_type>()) : static_cast<bits_type>(~bits);
+        T value;
+        std::memcpy(&value, &bits, sizeof(T));
+        return value;
+    }
+
+    /** the sign bit of T in an unsigned integer U of the same size as T, or 0 if T is unsigned */
+    template<typename U>
+    static U sign_bit() {
+        return std::is_signed<T>::value ? static_cast<U>(U(1) << (8 * sizeof(T) - 1)) : U(0);
+    }
+
+    /** number of bits needed to store value */
+    static uint8_t bit_width(uint64_t value) {
+        uint8_t width = 0;
+        for (; value; value >>= 1) width++;
+        return width;
+    }
+
+    /** append the low width bits of value at offset, advancing it */
+    void pack(uint64_t value, uint8_t width, size_t &offset);
+
+    /**
+     * Write the count fields of the given width stored from offset on to out. The reader keeps its position as a word
+     * and a shift instead of dividing the bit offset of each field; bits_ ends with a padding word, so the word after
+     * the one holding the first bit of a field can be read unconditionally.
+     */
+    static void unpack(const uint64_t *bits, size_t offset, uint8_t width, size_t count, key_type *out) {
+        const uint64_t *word = bits + offset / 64;
+        size_t shift = offset % 64;
+        uint64_t mask = width == 64 ? ~uint64_t(0) : (uint64_t(1) << width) - 1;
+        for (size_t i = 0; i < count; i++) {
+            //the second shift is split in two to stay defined for shift == 0
+            uint64_t value = (word[0] >> shift) | ((word[1] << 1) << (63 - shift));
+            out[i] = static_cast<key_type>(value & mask);
+            shift += width;
+            word += shift / 64;
+            shift %= 64;
+        }
+    }
+
+    /** number of intervals in the given block */
+    size_t block_length(size_t block) const {
+        return std::min(block_size, values_.size() - block * block_size);
+    }
+
+    /** the endpoints of one block; as two members of one object, the compiler knows the arrays don't overlap */
+    struct DecodedBlock {
+        key_type starts[block_size];
+        key_type ends[block_size];
+    };
+
+    /**
+     * Write the starts and ends of the given block to the first block_length(block) entries of decoded. The entries
+     * after them are overwritten with meaningless values, so decoded must be initialized before the first call.
+     */
+    void decode_block(size_t block, DecodedBlock &decoded) const;
+
+    /** call visit(block) for every block in [lo, hi) below node of max_end_tree_ that is before last and ends after key */
+    template<typename F>
+    void visit_blocks(size_t node, size_t lo, size_t hi, size_t last, key_type key, F &visit) const;
+
+    std::vector<Block> blocks_;
+    std::vector<uint64_t> bits_;
+    std::vector<V> values_;
+    /** largest end of each block at the leaves, from position leaf_count_ on, and of each subtree of blocks above them */
+    std::vector<key_type> max_end_tree_;
+    size_t leaf_count_ = 0;
+};
+
+/* Definitions */
+
+template<typename T, typename V>
+constexpr size_t CompressedIntervalTree<T, V>::block_size;
+
+template<typename T, typename V>
+template<typename ForwardIt>
+CompressedIntervalTree<T, V>::CompressedIntervalTree(ForwardIt begin, ForwardIt end) {
+    build(begin, end);
+}
+
+template<typename T, typename V>
+template<typename ForwardIt>
+void CompressedIntervalTree<T, V>::build(ForwardIt begin, ForwardIt end) {
+    clear();
+    std::vector<key_type> starts;
+    std::vector<key_type> ends;
+    std::vector<V> values;
+    for (auto it = begin; it != end; it++) {
+        key_type start = encode(it->first.start);
+        key_type end_key = encode(it->first.end);
+        if (start < end_key) {
+            starts.push_back(start);
+            ends.push_back(end_key);
+            values.push_back(it->second);
+        }
+    }
+    size_t n = starts.size();
+    std::vector<size_t> order(n);
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return starts[a] < starts[b]; });
+    values_.reserve(n);
+    for (size_t i : order) {
+        values_.push_back(std::move(values[i]));
+    }
+    size_t offset = 0;
+    for (size_t first = 0; first < n; first += block_size) {
+        size_t last = std::min(n, first + block_size);
+        Block block;
+        block.first_start = starts[order[first]];
+        block.last_start = starts[order[last - 1]];
+        block.max_end = 0;
+        block.min_length = std::numeric_limits<key_type>::max();
+        key_type max_gap = 0;
+        key_type max_length = 0;
+        for (size_t i = first; i < last; i++) {
+            key_type length = ends[order[i]] - starts[order[i]];
+            block.max_end = std::max(block.max_end, ends[order[i]]);
+            block.min_length = std::min(block.min_length, length);
+            max_length = std::max(max_length, length);
+            if (i > first) {
+                max_gap = std::max<key_type>(max_gap, starts[order[i]] - starts[order[i - 1]]);
+            }
+        }
+        block.offset = offset;
+        block.start_width = bit_width(max_gap);
+        block.length_width = bit_width(max_length - block.min_length);
+        for (size_t i = first + 1; i < last; i++) {
+            pack(starts[order[i]] - starts[order[i - 1]], block.start_width, offset);
+        }
+        for (size_t i = first; i < last; i++) {
+            pack(ends[order[i]] - starts[order[i]] - block.min_length, block.length_width, offset);
+        }
+        blocks_.push_back(block);
+    }
+    bits_.resize(offset / 64 + 2, 0);
+    bits_.shrink_to_fit();
+    leaf_count_ = 1;
+    while (leaf_count_ < blocks_.size()) leaf_count_ *= 2;
+    //key 0 is the smallest, so the unused leaves are never after any query point
+    max_end_tree_.assign(2 * leaf_count_, 0);
+    for (size_t block = 0; block < blocks_.size(); block++) {
+        max_end_tree_[leaf_count_ + block] = blocks_[block].max_end;
+    }
+    for (size_t node = leaf_count_; node-- > 1;) {
+        max_end_tree_[node] = std::max(max_end_tree_[2 * node], max_end_tree_[2 * node + 1]);
+    }
+}
+
+template<typename T, typename V>
+void CompressedIntervalTree<T, V>::pack(uint64_t value, uint8_t width, size_t &offset) {
+    if (width == 0) return;
+    size_t shift = offset % 64;
+    if (bits_.size() < offset / 64 + 2) {
+        bits_.resize(offset / 64 + 2, 0);
+    }
+    bits_[offset / 64] |= value << shift;
+    if (shift + width > 64) {
+        bits_[offset / 64 + 1] |= value >> (64 - shift);
+    }
+    offset += width;
+}
+
+template<typename T, typename V>
+void CompressedIntervalTree<T, V>::decode_block(size_t block, DecodedBlock &decoded) const {
+    const Block &header = blocks_[block];
+    size_t n = block_length(block);
+    const uint64_t *bits = bits_.data();
+    key_type *starts = decoded.starts;
+    key_type *ends = decoded.ends;
+    //the unpacking is a serial bit reader and the prefix sum a dependency chain, but adding the starts and the
+    //shortest length to the unpacked lengths is independent per interval and vectorizes; it runs over the whole
+    //block, since a loop with a fixed trip count needs no scalar remainder
+    starts[0] = header.first_start;
+    unpack(bits, header.offset, header.start_width, n - 1, starts + 1);
+    for (size_t i = 1; i < n; i++) {
+        starts[i] += starts[i - 1];
+    }
+    unpack(bits, header.offset + (n - 1) * header.start_width, header.length_width, n, ends);
+    key_type min_length = header.min_length;
+    for (size_t i = 0; i < block_size; i++) {
+        ends[i] += starts[i] + min_length;
+    }
+}
+
+template<typename T, typename V>
+template<typename F>
+void CompressedIntervalTree<T, V>::visit_blocks(size_t node, size_t lo, size_t hi, size_t last, key_type key, F &visit) const {
+    if (lo >= last || !(key < max_end_tree_[node])) return;
+    if (hi - lo == 1) {
+        visit(lo);
+        return;
+    }
+    size_t mid = lo + (hi - lo) / 2;
+    visit_blocks(2 * node, lo, mid, last, key, visit);
+    visit_blocks(2 * node + 1, mid, hi, last, key, visit);
+}
+
+template<typename T, typename V>
+template<typename F>
+void CompressedIntervalTree<T, V>::query(T val, F f) const {
+    key_type key = encode(val);
+    //blocks starting after val hold no hits
+    size_t last = std::upper_bound(blocks_.begin(), blocks_.end(), key,
+                                   [](key_type k, const Block &block) { return k < block.first_start; }) - blocks_.begin();
+    DecodedBlock decoded = {};
+    auto visit = [&](size_t block) {
+        decode_block(block, decoded);
+        for (size_t i = 0; i < block_length(block); i++) {
+            if (decoded.starts[i] <= key && key < decoded.ends[i]) {
+                f(Interval<T>(decode(decoded.starts[i]), decode(decoded.ends[i])), values_[block * block_size + i]);
+            }
+        }
+    };
+    if (!blocks_.empty()) {
+        visit_blocks(1, 0, leaf_count_, last, key, visit);
+    }
+}
+
+template<typename T, typename V>
+template<typename F>
+void CompressedIntervalTree<T, V>::query(const Interval<T> &interval, F f) const {
+    //as in IntervalTree, the intervals containing the query start, plus the disjoint set of those starting strictly
+    //inside the query interval
+    query(interval.start, f);
+    key_type first = encode(interval.start);
+    key_type last = encode(interval.end);
+    if (!(first < last)) return;
+    DecodedBlock decoded = {};
+    auto block = std::upper_bound(blocks_.begin(), blocks_.end(), first,
+                                  [](key_type k, const Block &b) { return k < b.last_start; }) - blocks_.begin();
+    for (; block < static_cast<std::ptrdiff_t>(blocks_.size()) && blocks_[block].first_start < last; block++) {
+        decode_block(block, decoded);
+        for (size_t i = 0; i < block_length(block); i++) {
+            if (first < decoded.starts[i] && decoded.starts[i] < last) {
+                f(Interval<T>(decode(decoded.starts[i]), decode(decoded.ends[i])), values_[block * block_size + i]);
+            }
+        }
+    }
+}
+
+template<typename T, typename V>
+size_t CompressedIntervalTree<T, V>::count(T val) const {
+    size_t result = 0;
+    query(val, [&](const Interval<T> &, const V &) { result++; });
+    return result;
+}
+
+template<typename T, typename V>
+size_t CompressedIntervalTree<T, V>::size() const {
+    return values_.size();
+}
+
+template<typename T, typename V>
+size_t CompressedIntervalTree<T, V>::memory_usage() const {
+    return blocks_.capacity() * sizeof(Block) + bits_.capacity() * sizeof(uint64_t) + values_.capacity() * sizeof(V) +
+           max_end_tree_.capacity() * sizeof(key_type);
+}
+
+template<typename T, typename V>
+void CompressedIntervalTree<T, V>::clear() {
+    blocks_.clear();
+    bits_.clear();
+    values_.clear();
+    max_end_tree_.clear();
+    leaf_count_ = 0;
+}
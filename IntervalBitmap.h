@@ -0,0 +1,363 @@
+#pragma once
+
+#include "IntervalTree.h"
+
+/**
+ * Compressed set of interval indices, as written by IntervalTree::query_ids(), supporting fast set algebra between
+ * the results of different queries. Following the roaring bitmap layout, indices are grouped by their upper 16 bits
+ * and each group is stored as a sorted array while it holds at most array_max_size indices, or as a 65536 bit bitmap
+ * otherwise, so both sparse and dense results stay compact.
+ */
+class IntervalBitmap {
+public:
+    /** largest group kept as a sorted array; beyond this a bitmap takes less space */
+    static constexpr size_t array_max_size = 4096;
+
+    IntervalBitmap() = default;
+
+    /**
+     * Construct from a range of indices in any order, possibly with duplicates
+     */
+    template<typename InputIt>
+    IntervalBitmap(InputIt first, InputIt last);
+
+    void add(uint32_t index);
+
+    bool contains(uint32_t index) const;
+
+    /** number of indices in the set */
+    size_t cardinality() const;
+
+    bool empty() const;
+
+    /** intersection */
+    IntervalBitmap &operator&=(const IntervalBitmap &other);
+    /** union */
+    IntervalBitmap &operator|=(const IntervalBitmap &other);
+    /** difference (and-not) */
+    IntervalBitmap &operator-=(const IntervalBitmap &other);
+
+    friend IntervalBitmap operator&(IntervalBitmap a, const IntervalBitmap &b) {
+        return a &= b;
+    }
+    friend IntervalBitmap operator|(IntervalBitmap a, const IntervalBitmap &b) {
+        return a |= b;
+    }
+    friend IntervalBitmap operator-(IntervalBitmap a, const IntervalBitmap &b) {
+        return a -= b;
+    }
+
+    /**
+     * Call f(index) for every index in the set, in increasing order
+     */
+    template<typename F>
+    void for_each(F f) const;
+
+    /**
+     * Write every index in the set in increasing order
+     * @return output iterator past the last written index
+     */
+    template<typename OutputIt>
+    OutputIt copy(OutputIt out) const;
+
+private:
+    static constexpr size_t bitmap_words = 65536 / 64;
+
+    /** the indices whose upper 16 bits equal key, as either a sorted array or a bitmap */
+    struct Container {
+        uint16_t key = 0;
+        size_t cardinality = 0;
+        std::vector<uint16_t> array;
+        std::vector<uint64_t> bits;
+
+        bool is_bitmap() const {
+            return !bits.empty();
+        }
+        bool contains(uint16_t low) const;
+        /** switch to the representation that suits the current cardinality */
+        void normalize();
+    };
+
+    static size_t popcount(uint64_t word) {
+#if defined(__GNUC__) || defined(__clang__)
+        return __builtin_popcountll(word);
+#else
+        size_t n = 0;
+        for (; word; word &= word - 1) n++;
+        return n;
+#endif
+    }
+
+    /** position of the lowest set bit of a nonzero word */
+    static size_t lowest_bit(uint64_t word) {
+#if defined(__GNUC__) || defined(__clang__)
+        return __builtin_ctzll(word);
+#else
+        size_t bit = 0;
+        while (!((word >> bit) & 1)) bit++;
+        return bit;
+#endif
+    }
+
+    /** bitmap of the indices of a container, whichever way it is stored */
+    static std::vector<uint64_t> to_bits(const Container &container);
+
+    /** the container for key, or nullptr */
+    const Container *find(uint16_t key) const;
+
+    /** containers sorted by key, none of them empty */
+    std::vector<Container> containers_;
+};
+
+/**
+ * Find the indices of all intervals matching a query, as a bitmap for combining with the results of other queries;
+ * tree.cbegin()[index] is the matching interval-value pair.
+ * @param query a query point or Interval<T>, with the same semantics as IntervalTree::query()
+ */
+template<typename T, typename V, typename Query>
+IntervalBitmap query_bitmap(const IntervalTree<T, V> &tree, const Query &query) {
+    std::vector<uint32_t> ids;
+    tree.query_ids(query, std::back_inserter(ids));
+    return IntervalBitmap(ids.begin(), ids.end());
+}
+
+/* Definitions */
+
+template<typename InputIt>
+IntervalBitmap::IntervalBitmap(InputIt first, InputIt last) {
+    std::vector<uint32_t> indices(first, last);
+    std::sort(indices.begin(), indices.end());
+    indices.erase(std::unique(indices.begin(), indices.end()), indices.end());
+    for (size_t i = 0; i < indices.size();) {
+        Container container;
+        container.key = static_cast<uint16_t>(indices[i] >> 16);
+        for (; i < indices.size() && indices[i] >> 16 == container.key; i++) {
+            container.array.push_back(static_cast<uint16_t>(indices[i]));
+        }
+        container.cardinality = container.array.size();
+        container.normalize();
+        containers_.push_back(std::move(container));
+    }
+}
+
+inline bool IntervalBitmap::Container::contains(uint16_t low) const {
+    if (is_bitmap()) {
+        return (bits[low / 64] >> (low % 64)) & 1;
+    }
+    return std::binary_search(array.begin(), array.end(), low);
+}
+
+inline void IntervalBitmap::Container::normalize() {
+    if (is_bitmap() && cardinality <= array_max_size) {
+        array.clear();
+        array.reserve(cardinality);
+        for (size_t w = 0; w < bitmap_words; w++) {
+            for (uint64_t word = bits[w]; word; word &= word - 1) {
+                array.push_back(static_cast<uint16_t>(w * 64 + lowest_bit(word)));
+            }
+        }
+        std::vector<uint64_t>().swap(bits);
+    } else if (!is_bitmap() && cardinality > array_max_size) {
+        bits.assign(bitmap_words, 0);
+        for (uint16_t low : array) {
+            bits[low / 64] |= uint64_t(1) << (low % 64);
+        }
+        std::vector<uint16_t>().swap(array);
+    }
+}
+
+inline std::vector<uint64_t> IntervalBitmap::to_bits(const Container &container) {
+    if (container.is_bitmap()) {
+        return container.bits;
+    }
+    std::vector<uint64_t> bits(bitmap_words, 0);
+    for (uint16_t low : container.array) {
+        bits[low / 64] |= uint64_t(1) << (low % 64);
+    }
+    return bits;
+}
+
+inline const IntervalBitmap::Container *IntervalBitmap::find(uint16_t key) const {
+    auto it = std::lower_bound(containers_.begin(), containers_.end(), key,
+                               [](const Container &c, uint16_t k) { return c.key < k; });
+    return it != containers_.end() && it->key == key ? &*it : nullptr;
+}
+
+inline void IntervalBitmap::add(uint32_t index) {
+    uint16_t key = static_cast<uint16_t>(index >> 16);
+    uint16_t low = static_cast<uint16_t>(index);
+    auto it = std::lower_bound(containers_.begin(), containers_.end(), key,
+                               [](const Container &c, uint16_t k) { return c.key < k; });
+    if (it == containers_.end() || it->key != key) {
+        it = containers_.insert(it, Container());
+        it->key = key;
+    }
+    if (it->is_bitmap()) {
+        uint64_t &word = it->bits[low / 64];
+        it->cardinality += !((word >> (low % 64)) & 1);
+        word |= uint64_t(1) << (low % 64);
+    } else {
+        auto pos = std::lower_bound(it->array.begin(), it->array.end(), low);
+        if (pos == it->array.end() || *pos != low) {
+            it->array.insert(pos, low);
+            it->cardinality++;
+            it->normalize();
+        }
+    }
+}
+
+inline bool IntervalBitmap::contains(uint32_t index) const {
+    const Container *container = find(static_cast<uint16_t>(index >> 16));
+    return container && container->contains(static_cast<uint16_t>(index));
+}
+
+inline size_t IntervalBitmap::cardinality() const {
+    size_t n = 0;
+    for (const Container &container : containers_) {
+        n += container.cardinality;
+    }
+    return n;
+}
+
+inline bool IntervalBitmap::empty() const {
+    return containers_.empty();
+}
+
+inline IntervalBitmap &IntervalBitmap::operator&=(const IntervalBitmap &other) {
+    std::vector<Container> result;
+    for (Container &container : containers_) {
+        const Container *match = other.find(container.key);
+        if (!match) continue;
+        if (container.is_bitmap() && match->is_bitmap()) {
+            container.cardinality = 0;
+            for (size_t w = 0; w < bitmap_words; w++) {
+                container.bits[w] &= match->bits[w];
+                container.cardinality += popcount(container.bits[w]);
+            }
+        } else if (!container.is_bitmap()) {
+            //an array result is never larger than the array operand, so filter it in place
+            auto end = std::remove_if(container.array.begin(), container.array.end(),
+                                      [&](uint16_t low) { return !match->contains(low); });
+            container.array.erase(end, container.array.end());
+            container.cardinality = container.array.size();
+        } else {
+            std::vector<uint16_t> array;
+            for (uint16_t low : match->array) {
+                if (container.contains(low)) array.push_back(low);
+            }
+            std::vector<uint64_t>().swap(container.bits);
+            container.array = std::move(array);
+            container.cardinality = container.array.size();
+        }
+        container.normalize();
+        if (container.cardinality > 0) {
+            result.push_back(std::move(container));
+        }
+    }
+    containers_ = std::move(result);
+    return *this;
+}
+
+inline IntervalBitmap &IntervalBitmap::operator|=(const IntervalBitmap &other) {
+    std::vector<Container> result;
+    result.reserve(containers_.size() + other.containers_.size());
+    size_t i = 0;
+    size_t j = 0;
+    while (i < containers_.size() || j < other.containers_.size()) {
+        if (j == other.containers_.size() || (i < containers_.size() && containers_[i].key < other.containers_[j].key)) {
+            result.push_back(std::move(containers_[i++]));
+        } else if (i == containers_.size() || other.containers_[j].key < containers_[i].key) {
+            result.push_back(other.containers_[j++]);
+        } else {
+            Container &container = containers_[i++];
+            const Container &match = other.containers_[j++];
+            if (!container.is_bitmap() && !match.is_bitmap()) {
+                std::vector<uint16_t> array;
+                array.reserve(container.array.size() + match.array.size());
+                std::set_union(container.array.begin(), container.array.end(), match.array.begin(), match.array.end(),
+                               std::back_inserter(array));
+                container.array = std::move(array);
+                container.cardinality = container.array.size();
+            } else {
+                std::vector<uint64_t> bits = to_bits(container);
+                container.cardinality = 0;
+                for (size_t w = 0; w < bitmap_words; w++) {
+                    bits[w] |= match.is_bitmap() ? match.bits[w] : 0;
+                }
+                if (!match.is_bitmap()) {
+                    for (uint16_t low : match.array) {
+                        bits[low / 64] |= uint64_t(1) << (low % 64);
+                    }
+                }
+                for (uint64_t word : bits) {
+                    container.cardinality += popcount(word);
+                }
+                std::vector<uint16_t>().swap(container.array);
+                container.bits = std::move(bits);
+            }
+            container.normalize();
+            result.push_back(std::move(container));
+        }
+    }
+    containers_ = std::move(result);
+    return *this;
+}
+
+inline IntervalBitmap &IntervalBitmap::operator-=(const IntervalBitmap &other) {
+    std::vector<Container> result;
+    for (Container &container : containers_) {
+        const Container *match = other.find(container.key);
+        if (match) {
+            if (container.is_bitmap()) {
+                container.cardinality = 0;
+                if (match->is_bitmap()) {
+                    for (size_t w = 0; w < bitmap_words; w++) {
+                        container.bits[w] &= ~match->bits[w];
+                    }
+                } else {
+                    for (uint16_t low : match->array) {
+                        container.bits[low / 64] &= ~(uint64_t(1) << (low % 64));
+                    }
+                }
+                for (uint64_t word : container.bits) {
+                    container.cardinality += popcount(word);
+                }
+            } else {
+                auto end = std::remove_if(container.array.begin(), container.array.end(),
+                                          [&](uint16_t low) { return match->contains(low); });
+                container.array.erase(end, container.array.end());
+                container.cardinality = container.array.size();
+            }
+            container.normalize();
+        }
+        if (container.cardinality > 0) {
+            result.push_back(std::move(container));
+        }
+    }
+    containers_ = std::move(result);
+    return *this;
+}
+
+template<typename F>
+void IntervalBitmap::for_each(F f) const {
+    for (const Container &container : containers_) {
+        uint32_t high = static_cast<uint32_t>(container.key) << 16;
+        if (container.is_bitmap()) {
+            for (size_t w = 0; w < bitmap_words; w++) {
+                for (uint64_t word = container.bits[w]; word; word &= word - 1) {
+                    f(high | static_cast<uint32_t>(w * 64 + lowest_bit(word)));
+                }
+            }
+        } else {
+            for (uint16_t low : container.array) {
+                f(high | low);
+            }
+        }
+    }
+}
+
+template<typename OutputIt>
+OutputIt IntervalBitmap::copy(OutputIt out) const {
+    for_each([&](uint32_t index) { *out++ = index; });
+    return out;
+}
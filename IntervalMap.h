@@ -0,0 +1,142 @@
+#pragma once
+
+#include "IntervalTree.h"
+#include <map>
+
+/**
+ * An interval map assigns values to ranges of the number line, with later assignments overwriting earlier ones.
+ * It is stored as disjoint half-open segments keyed by their start, and adjacent segments holding equal values are
+ * merged, so memory stays proportional to the number of distinct segments however often ranges are reassigned.
+ * @tparam T floating point type used by intervals
+ * @tparam V stored value type; must be equality comparable
+ */
+template<typename T, typename V>
+class IntervalMap {
+public:
+    /** a segment [start, end) holding value; start is the key it is stored under */
+    struct Segment {
+        T end;
+        V value;
+    };
+
+    using const_iterator = typename std::map<T, Segment>::const_iterator;
+
+    /**
+     * Set the value of every point in the range, splitting segments that extend past its ends
+     * @param interval the half-open range [a, b); nothing happens unless a < b
+     * @param value value to store
+     */
+    void assign(const Interval<T> &interval, const V &value);
+
+    /**
+     * Remove the value of every point in the range, splitting segments that extend past its ends
+     * @param interval the half-open range [a, b); nothing happens unless a < b
+     */
+    void erase(const Interval<T> &interval);
+
+    /**
+     * Look up the value at a point in O(log n)
+     * @param val query point
+     * @return the value assigned at val, or nullptr if there is none
+     */
+    const V *find(T val) const;
+
+    /** number of segments */
+    size_t size() const;
+
+    bool empty() const;
+
+    /** iterators over the segments in increasing order, as pairs of start and Segment */
+    const_iterator begin() const;
+    const_iterator end() const;
+
+    /**
+     * Clears all data
+     */
+    void clear();
+
+private:
+    std::map<T, Segment> segments_;
+};
+
+/* Definitions */
+
+template<typename T, typename V>
+void IntervalMap<T, V>::assign(const Interval<T> &interval, const V &value) {
+    if (!(interval.start < interval.end)) return;
+    erase(interval);
+    auto it = segments_.emplace(interval.start, Segment{interval.end, value}).first;
+    //merge with the following segment if it continues this one with the same value
+    auto next = std::next(it);
+    if (next != segments_.end() && next->first == it->second.end && next->second.value == value) {
+        it->second.end = next->second.end;
+        segments_.erase(next);
+    }
+    //merge into the preceding segment likewise
+    if (it != segments_.begin()) {
+        auto prev = std::prev(it);
+        if (prev->second.end == it->first && prev->second.value == value) {
+            prev->second.end = it->second.end;
+            segments_.erase(it);
+        }
+    }
+}
+
+template<typename T, typename V>
+void IntervalMap<T, V>::erase(const Interval<T> &interval) {
+    if (!(interval.start < interval.end)) return;
+    auto it = segments_.lower_bound(interval.start);
+    //a segment starting before the range may reach into it
+    if (it != segments_.begin()) {
+        auto prev = std::prev(it);
+        if (prev->second.end > interval.start) {
+            if (prev->second.end > interval.end) {
+                segments_.emplace_hint(it, interval.end, Segment{prev->second.end, prev->second.value});
+            }
+            prev->second.end = interval.start;
+        }
+    }
+    //segments starting inside the range are removed, except for the part of the last one extending past it
+    while (it != segments_.end() && it->first < interval.end) {
+        if (it->second.end > interval.end) {
+            Segment tail{it->second.end, it->second.value};
+            it = segments_.erase(it);
+            segments_.emplace_hint(it, interval.end, std::move(tail));
+            break;
+        }
+        it = segments_.erase(it);
+    }
+}
+
+template<typename T, typename V>
+const V *IntervalMap<T, V>::find(T val) const {
+    auto it = segments_.upper_bound(val);
+    if (it == segments_.begin()) return nullptr;
+    --it;
+    return val < it->second.end ? &it->second.value : nullptr;
+}
+
+template<typename T, typename V>
+size_t IntervalMap<T, V>::size() const {
+    return segments_.size();
+}
+
+template<typename T, typename V>
+bool IntervalMap<T, V>::empty() const {
+    return segments_.empty();
+}
+
+template<typename T, typename V>
+typename IntervalMap<T, V>::const_iterator IntervalMap<T, V>::begin() const {
+    return segments_.cbegin();
+}
+
+template<typename T, typename V>
+typename IntervalMap<T, V>::const_iterator IntervalMap<T, V>::end() const {
+    return segments_.cend();
+}
+
+template<typename T, typename V>
+void IntervalMap<T, V>::clear() {
+    segments_.clear();
+}
@@ -7,71 +7,508 @@
 #include <memory>
 #include <algorithm>
 #include <vector>
+#include <array>
+#include <cmath>
+#include <functional>
+#include <type_traits>
 #include <limits>
 #include <numeric>
-#include <unordered_set>
+#include <cstdint>
+#include <iterator>
+#include <cstddef>
+#include <stdexcept>
+
+//vector kernels for the key scans below, chosen at run time; define INTERVALTREE_NO_SIMD to always use the scalar loops
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__)) && !defined(INTERVALTREE_NO_SIMD)
+#define INTERVALTREE_X86_SIMD
+#include <immintrin.h>
+#endif
 
 template<typename T>
 struct Interval {
-    Interval(const T &start_p, const T &end_p) : start(start_p), end(end_p) {}
+    constexpr Interval(const T &start_p, const T &end_p) : start(start_p), end(end_p) {}
 
     T start;
     T end;
 };
 
+/**
+ * What IntervalTree<T, V> stores per interval: an interval-value pair, or the bare interval when V is void, so that a
+ * tree used as a set of intervals spends no memory on values.
+ */
+template<typename T, typename V>
+struct IntervalTreeEntry {
+    using type = std::pair<Interval<T>, V>;
+    using mapped_type = V;
+
+    static const Interval<T> &interval(const type &entry) {
+        return entry.first;
+    }
+
+    static const V &value(const type &entry) {
+        return entry.second;
+    }
+};
+
+template<typename T>
+struct IntervalTreeEntry<T, void> {
+    using type = Interval<T>;
+    /** stands in for the value in the signatures that take one, which a tree without values rejects at compile time */
+    struct mapped_type {};
+
+    static const Interval<T> &interval(const type &entry) {
+        return entry;
+    }
+
+    static const mapped_type &value(const type &) {
+        static const mapped_type none{};
+        return none;
+    }
+};
+
 template<typename T, typename V>
 struct IntervalComp {
-    IntervalComp(const std::vector<std::pair<Interval<T>, V>> &intervals, const std::vector<size_t> &indices, bool sort_by_start) : intervals_(
-            intervals), indices_(indices), sort_by_start_(sort_by_start) {}
+    IntervalComp(const std::vector<typename IntervalTreeEntry<T, V>::type> &intervals, bool sort_by_start) : intervals_(
+            intervals), sort_by_start_(sort_by_start) {}
 
     bool operator()(size_t a, size_t b) const {
+        const Interval<T> &x = IntervalTreeEntry<T, V>::interval(intervals_[a]);
+        const Interval<T> &y = IntervalTreeEntry<T, V>::interval(intervals_[b]);
         if (sort_by_start_) {
-            return intervals_[indices_[a]].first.start < intervals_[indices_[b]].first.start;
+            return x.start < y.start;
         } else {
-            return intervals_[indices_[a]].first.end < intervals_[indices_[b]].first.end;
+            return x.end < y.end;
         }
     }
 
-    const std::vector<size_t> &indices_;
-    const std::vector<std::pair<Interval<T>, V>> &intervals_;
+    const std::vector<typename IntervalTreeEntry<T, V>::type> &intervals_;
     bool sort_by_start_;
 };
 
-/*template<typename T, typename V>
-struct IntervalValueComp {
-    IntervalValueComp(const std::vector<std::pair<Interval<T>, V>> &intervals, bool sort_by_start) : intervals_(
-            intervals), sort_by_start_(sort_by_start) {}
+#ifdef INTERVALTREE_X86_SIMD
 
-    bool operator()(size_t a, size_t b) const {
-        if (sort_by_start_) {
-            return intervals_[a].first.start < intervals_[b].first.start;
-        } else {
-            return intervals_[a].first.end < intervals_[b].first.end;
+#define INTERVALTREE_AVX2 __attribute__((target("avx2,popcnt")))
+#define INTERVALTREE_AVX512 __attribute__((target("avx512f,popcnt")))
+
+enum class SimdLevel {
+    Scalar,
+    Avx2,
+    Avx512
+};
+
+/** widest vector instruction set that both the CPU and the operating system support */
+inline SimdLevel simd_level() {
+    static const SimdLevel level = []() {
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512f")) return SimdLevel::Avx512;
+        if (__builtin_cpu_supports("avx2")) return SimdLevel::Avx2;
+        return SimdLevel::Scalar;
+    }();
+    return level;
+}
+
+/**
+ * Compares one vector of keys loaded from memory with a broadcast value, returning a bit per lane. Specialized for
+ * float, double and 32 or 64 bit integers; unsigned integers are compared as signed ones with the sign bit flipped.
+ */
+template<SimdLevel Level, typename T, typename Enable = void>
+struct SimdLanes {
+    static constexpr bool supported = false;
+};
+
+template<typename T>
+using simd_int32 = typename std::enable_if<std::is_integral<T>::value && sizeof(T) == 4>::type;
+
+template<typename T>
+using simd_int64 = typename std::enable_if<std::is_integral<T>::value && sizeof(T) == 8>::type;
+
+template<>
+struct SimdLanes<SimdLevel::Avx2, float> {
+    static constexpr bool supported = true;
+    static constexpr size_t width = 8;
+    using vector = __m256;
+    INTERVALTREE_AVX2 static vector broadcast(float val) { return _mm256_set1_ps(val); }
+    template<bool Greater>
+    INTERVALTREE_AVX2 static unsigned compare(const float *keys, vector val) {
+        return _mm256_movemask_ps(_mm256_cmp_ps(_mm256_loadu_ps(keys), val, Greater ? _CMP_GT_OQ : _CMP_LE_OQ));
+    }
+};
+
+template<>
+struct SimdLanes<SimdLevel::Avx2, double> {
+    static constexpr bool supported = true;
+    static constexpr size_t width = 4;
+    using vector = __m256d;
+    INTERVALTREE_AVX2 static vector broadcast(double val) { return _mm256_set1_pd(val); }
+    template<bool Greater>
+    INTERVALTREE_AVX2 static unsigned compare(const double *keys, vector val) {
+        return _mm256_movemask_pd(_mm256_cmp_pd(_mm256_loadu_pd(keys), val, Greater ? _CMP_GT_OQ : _CMP_LE_OQ));
+    }
+};
+
+template<typename T>
+struct SimdLanes<SimdLevel::Avx2, T, simd_int32<T>> {
+    static constexpr bool supported = true;
+    static constexpr size_t width = 8;
+    using vector = __m256i;
+    static constexpr int32_t flip = std::is_signed<T>::value ? 0 : std::numeric_limits<int32_t>::min();
+    INTERVALTREE_AVX2 static vector broadcast(T val) { return _mm256_set1_epi32(static_cast<int32_t>(val) ^ flip); }
+    template<bool Greater>
+    INTERVALTREE_AVX2 static unsigned compare(const T *keys, vector val) {
+        __m256i loaded = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(keys)), _mm256_set1_epi32(flip));
+        unsigned greater = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(loaded, val)));
+        return Greater ? greater : ~greater & 0xFFu;
+    }
+};
+
+template<typename T>
+struct SimdLanes<SimdLevel::Avx2, T, simd_int64<T>> {
+    static constexpr bool supported = true;
+    static constexpr size_t width = 4;
+    using vector = __m256i;
+    static constexpr int64_t flip = std::is_signed<T>::value ? 0 : std::numeric_limits<int64_t>::min();
+    INTERVALTREE_AVX2 static vector broadcast(T val) { return _mm256_set1_epi64x(static_cast<int64_t>(val) ^ flip); }
+    template<bool Greater>
+    INTERVALTREE_AVX2 static unsigned compare(const T *keys, vector val) {
+        __m256i loaded = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(keys)), _mm256_set1_epi64x(flip));
+        unsigned greater = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(loaded, val)));
+        return Greater ? greater : ~greater & 0xFu;
+    }
+};
+
+template<>
+struct SimdLanes<SimdLevel::Avx512, float> {
+    static constexpr bool supported = true;
+    static constexpr size_t width = 16;
+    using vector = __m512;
+    INTERVALTREE_AVX512 static vector broadcast(float val) { return _mm512_set1_ps(val); }
+    template<bool Greater>
+    INTERVALTREE_AVX512 static unsigned compare(const float *keys, vector val) {
+        return _mm512_cmp_ps_mask(_mm512_loadu_ps(keys), val, Greater ? _CMP_GT_OQ : _CMP_LE_OQ);
+    }
+    /** compare only the first count < width keys, without reading past them */
+    template<bool Greater>
+    INTERVALTREE_AVX512 static unsigned compare_first(const float *keys, vector val, size_t count) {
+        __mmask16 lanes = static_cast<__mmask16>((1u << count) - 1);
+        return _mm512_mask_cmp_ps_mask(lanes, _mm512_maskz_loadu_ps(lanes, keys), val, Greater ? _CMP_GT_OQ : _CMP_LE_OQ);
+    }
+};
+
+template<>
+struct SimdLanes<SimdLevel::Avx512, double> {
+    static constexpr bool supported = true;
+    static constexpr size_t width = 8;
+    using vector = __m512d;
+    INTERVALTREE_AVX512 static vector broadcast(double val) { return _mm512_set1_pd(val); }
+    template<bool Greater>
+    INTERVALTREE_AVX512 static unsigned compare(const double *keys, vector val) {
+        return _mm512_cmp_pd_mask(_mm512_loadu_pd(keys), val, Greater ? _CMP_GT_OQ : _CMP_LE_OQ);
+    }
+    template<bool Greater>
+    INTERVALTREE_AVX512 static unsigned compare_first(const double *keys, vector val, size_t count) {
+        __mmask8 lanes = static_cast<__mmask8>((1u << count) - 1);
+        return _mm512_mask_cmp_pd_mask(lanes, _mm512_maskz_loadu_pd(lanes, keys), val, Greater ? _CMP_GT_OQ : _CMP_LE_OQ);
+    }
+};
+
+template<typename T>
+struct SimdLanes<SimdLevel::Avx512, T, simd_int32<T>> {
+    static constexpr bool supported = true;
+    static constexpr size_t width = 16;
+    using vector = __m512i;
+    INTERVALTREE_AVX512 static vector broadcast(T val) { return _mm512_set1_epi32(static_cast<int32_t>(val)); }
+    template<bool Greater>
+    INTERVALTREE_AVX512 static unsigned compare(const T *keys, vector val) {
+        __m512i loaded = _mm512_loadu_si512(keys);
+        const int predicate = Greater ? _MM_CMPINT_NLE : _MM_CMPINT_LE;
+        return std::is_signed<T>::value ? _mm512_cmp_epi32_mask(loaded, val, predicate)
+                                        : _mm512_cmp_epu32_mask(loaded, val, predicate);
+    }
+    template<bool Greater>
+    INTERVALTREE_AVX512 static unsigned compare_first(const T *keys, vector val, size_t count) {
+        __mmask16 lanes = static_cast<__mmask16>((1u << count) - 1);
+        __m512i loaded = _mm512_maskz_loadu_epi32(lanes, keys);
+        const int predicate = Greater ? _MM_CMPINT_NLE : _MM_CMPINT_LE;
+        return std::is_signed<T>::value ? _mm512_mask_cmp_epi32_mask(lanes, loaded, val, predicate)
+                                        : _mm512_mask_cmp_epu32_mask(lanes, loaded, val, predicate);
+    }
+};
+
+template<typename T>
+struct SimdLanes<SimdLevel::Avx512, T, simd_int64<T>> {
+    static constexpr bool supported = true;
+    static constexpr size_t width = 8;
+    using vector = __m512i;
+    INTERVALTREE_AVX512 static vector broadcast(T val) { return _mm512_set1_epi64(static_cast<int64_t>(val)); }
+    template<bool Greater>
+    INTERVALTREE_AVX512 static unsigned compare(const T *keys, vector val) {
+        __m512i loaded = _mm512_loadu_si512(keys);
+        const int predicate = Greater ? _MM_CMPINT_NLE : _MM_CMPINT_LE;
+        return std::is_signed<T>::value ? _mm512_cmp_epi64_mask(loaded, val, predicate)
+                                        : _mm512_cmp_epu64_mask(loaded, val, predicate);
+    }
+    template<bool Greater>
+    INTERVALTREE_AVX512 static unsigned compare_first(const T *keys, vector val, size_t count) {
+        __mmask8 lanes = static_cast<__mmask8>((1u << count) - 1);
+        __m512i loaded = _mm512_maskz_loadu_epi64(lanes, keys);
+        const int predicate = Greater ? _MM_CMPINT_NLE : _MM_CMPINT_LE;
+        return std::is_signed<T>::value ? _mm512_mask_cmp_epi64_mask(lanes, loaded, val, predicate)
+                                        : _mm512_mask_cmp_epu64_mask(lanes, loaded, val, predicate);
+    }
+};
+
+/**
+ * Number of keys[0, done) that are > val if Greater is set, else <= val, where done is the number of keys the kernel
+ * compared; the AVX2 kernel leaves the keys after the last whole vector to the caller
+ */
+template<bool Greater, typename T>
+INTERVALTREE_AVX2 size_t simd_count_avx2(const T *keys, size_t size, T val, size_t &done) {
+    using lanes = SimdLanes<SimdLevel::Avx2, T>;
+    auto broadcast = lanes::broadcast(val);
+    size_t n = 0;
+    for (done = 0; done + lanes::width <= size; done += lanes::width) {
+        n += __builtin_popcount(lanes::template compare<Greater>(keys + done, broadcast));
+    }
+    return n;
+}
+
+template<bool Greater, typename T>
+INTERVALTREE_AVX512 size_t simd_count_avx512(const T *keys, size_t size, T val, size_t &done) {
+    using lanes = SimdLanes<SimdLevel::Avx512, T>;
+    auto broadcast = lanes::broadcast(val);
+    size_t n = 0;
+    for (done = 0; done + lanes::width <= size; done += lanes::width) {
+        n += __builtin_popcount(lanes::template compare<Greater>(keys + done, broadcast));
+    }
+    if (done < size) {
+        n += __builtin_popcount(lanes::template compare_first<Greater>(keys + done, broadcast, size - done));
+        done = size;
+    }
+    return n;
+}
+
+/** bit i set for each of keys[0, done) that is > val if Greater is set, else <= val, for size <= 64 */
+template<bool Greater, typename T>
+INTERVALTREE_AVX2 uint64_t simd_mask_avx2(const T *keys, size_t size, T val, size_t &done) {
+    using lanes = SimdLanes<SimdLevel::Avx2, T>;
+    auto broadcast = lanes::broadcast(val);
+    uint64_t mask = 0;
+    for (done = 0; done + lanes::width <= size; done += lanes::width) {
+        mask |= static_cast<uint64_t>(lanes::template compare<Greater>(keys + done, broadcast)) << done;
+    }
+    return mask;
+}
+
+template<bool Greater, typename T>
+INTERVALTREE_AVX512 uint64_t simd_mask_avx512(const T *keys, size_t size, T val, size_t &done) {
+    using lanes = SimdLanes<SimdLevel::Avx512, T>;
+    auto broadcast = lanes::broadcast(val);
+    uint64_t mask = 0;
+    for (done = 0; done + lanes::width <= size; done += lanes::width) {
+        mask |= static_cast<uint64_t>(lanes::template compare<Greater>(keys + done, broadcast)) << done;
+    }
+    if (done < size) {
+        mask |= static_cast<uint64_t>(lanes::template compare_first<Greater>(keys + done, broadcast, size - done)) << done;
+        done = size;
+    }
+    return mask;
+}
+
+#endif
+
+/**
+ * Branchless scans over short arrays of keys. With GCC or Clang on x86, float, double and 32 or 64 bit integer keys
+ * are compared a vector at a time with AVX-512 or AVX2, whichever simd_level() finds, so that no -m flags are needed;
+ * other key types and targets, and builds defining INTERVALTREE_NO_SIMD, use the scalar loop.
+ */
+template<typename T>
+struct KeyScan {
+    /** number of keys[0, size) that are <= val */
+    static size_t count_less_equal(const T *keys, size_t size, T val) {
+        return count<false>(keys, size, val);
+    }
+
+    /** number of keys[0, size) that are > val */
+    static size_t count_greater(const T *keys, size_t size, T val) {
+        return count<true>(keys, size, val);
+    }
+
+    /** bit i set for each of keys[0, size) that is <= val, for size <= 64 */
+    static uint64_t mask_less_equal(const T *keys, size_t size, T val) {
+        return mask<false>(keys, size, val);
+    }
+
+    /** bit i set for each of keys[0, size) that is > val, for size <= 64 */
+    static uint64_t mask_greater(const T *keys, size_t size, T val) {
+        return mask<true>(keys, size, val);
+    }
+
+private:
+    template<bool Greater>
+    static uint64_t mask(const T *keys, size_t size, T val) {
+        size_t done = 0;
+        uint64_t result = 0;
+#ifdef INTERVALTREE_X86_SIMD
+        result = mask_vectors<Greater>(keys, size, val, done,
+                                       std::integral_constant<bool, SimdLanes<SimdLevel::Avx2, T>::supported>());
+#endif
+        for (size_t i = done; i < size; i++) {
+            result |= static_cast<uint64_t>(Greater ? val < keys[i] : keys[i] <= val) << i;
         }
+        return result;
     }
 
-    const std::vector<std::pair<Interval<T>, V> *> &intervals_;
-    bool sort_by_start_;
-};*/
+    template<bool Greater>
+    static size_t count(const T *keys, size_t size, T val) {
+        size_t done = 0;
+        size_t n = 0;
+#ifdef INTERVALTREE_X86_SIMD
+        n = count_vectors<Greater>(keys, size, val, done,
+                                   std::integral_constant<bool, SimdLanes<SimdLevel::Avx2, T>::supported>());
+#endif
+        for (size_t i = done; i < size; i++) {
+            n += Greater ? val < keys[i] : keys[i] <= val;
+        }
+        return n;
+    }
+
+#ifdef INTERVALTREE_X86_SIMD
+    template<bool Greater>
+    static size_t count_vectors(const T *keys, size_t size, T val, size_t &done, std::true_type) {
+        switch (simd_level()) {
+            case SimdLevel::Avx512:
+                return simd_count_avx512<Greater>(keys, size, val, done);
+            case SimdLevel::Avx2:
+                return simd_count_avx2<Greater>(keys, size, val, done);
+            default:
+                return 0;
+        }
+    }
+
+    template<bool Greater>
+    static size_t count_vectors(const T *, size_t, T, size_t &, std::false_type) {
+        return 0;
+    }
+
+    template<bool Greater>
+    static uint64_t mask_vectors(const T *keys, size_t size, T val, size_t &done, std::true_type) {
+        switch (simd_level()) {
+            case SimdLevel::Avx512:
+                return simd_mask_avx512<Greater>(keys, size, val, done);
+            case SimdLevel::Avx2:
+                return simd_mask_avx2<Greater>(keys, size, val, done);
+            default:
+                return 0;
+        }
+    }
+
+    template<bool Greater>
+    static uint64_t mask_vectors(const T *, size_t, T, size_t &, std::false_type) {
+        return 0;
+    }
+#endif
+};
 
 /**
  * Query result structure: call begin() and end() to access iterator over result pairs.
  * Only valid as long as the interval tree is unchanged since calling query().
+ * @tparam InlineHits number of hits stored inside the result object before spilling to the heap
  */
-template <typename T, typename V>
+template <typename T, typename V, size_t InlineHits = 4>
 class IntervalTreeResult;
 
+/**
+ * Query result stored as runs of consecutive entries of the tree's sorted index lists, which costs O(number of runs)
+ * instead of one pointer per hit. Iteration expands the runs lazily.
+ * Only valid as long as the interval tree is unchanged since calling query_runs().
+ */
+template <typename T, typename V>
+class IntervalTreeRuns;
+
+/**
+ * Incremental stabbing query for a monotonically moving point: reports which intervals entered and left since the
+ * previous position. Only valid as long as the interval tree is unchanged since constructing the cursor.
+ */
+template <typename T, typename V>
+class StabbingCursor;
+
+/**
+ * How build() organizes the intervals.
+ * Auto checks whether the intervals are disjoint and samples the input to pick the layout and split rule expected to
+ * answer queries fastest; Midpoint and Median always build a tree using the respective split rule.
+ */
+enum class BuildPolicy {
+    Auto,
+    Midpoint,
+    Median
+};
+
+/** Representation chosen for an interval tree's contents */
+enum class IntervalTreeLayout {
+    /** endpoint arrays scanned linearly */
+    Flat,
+    /** centered interval tree */
+    Tree,
+    /** endpoint arrays of pairwise disjoint intervals, binary searched */
+    Disjoint
+};
+
+/** Rule used to pick the center point of each tree node */
+enum class IntervalTreeSplit {
+    /** middle of the node's extent */
+    Midpoint,
+    /** median of the node's endpoints */
+    Median
+};
+
+/**
+ * Summary of an interval tree's structure, together with the properties of the intervals with positive length sampled
+ * at build time. BuildPolicy::Auto decides on length_spread and extent_skew; the others are reported for tuning.
+ */
+struct IntervalTreeStats {
+    IntervalTreeLayout layout = IntervalTreeLayout::Flat;
+    IntervalTreeSplit split = IntervalTreeSplit::Midpoint;
+    size_t size = 0;
+    size_t node_count = 0;
+    size_t depth = 0;
+    size_t max_center_size = 0;
+    /** extent of the sample divided by its median interval length; the midpoint split needs about log2 of this many levels */
+    double length_spread = 0;
+    /** distance of the sample's median midpoint from the center of its extent, relative to half the extent (0 to 1) */
+    double extent_skew = 0;
+    /** largest number of sampled intervals sharing a point; both splits put such intervals in a single node */
+    size_t sample_max_nesting = 0;
+    /** whether endpoints are of integral type; both splits handle the full range of such types */
+    bool integral = false;
+    /** number of linear segments in the learned model of the start order, or 0 if it is off */
+    size_t learned_segments = 0;
+};
+
 /**
  * An interval tree allows speedy intersection of a point on the number line with a collection of (possibly overlapping) intervals.
  * Intervals are inclusive on the left, exclusive on the right.
  * This structure acts as a tree multi-map with intersecting intervals as the keys.
+ * Collections smaller than a few hundred intervals skip the tree altogether and are answered by a linear scan over
+ * contiguous endpoint arrays; the tree is built transparently once the collection grows past that size.
+ * Likewise, collections of pairwise disjoint intervals are answered by a binary search over the same arrays until an
+ * insertion introduces an overlap.
  * @tparam T floating point type used by intervals
- * @tparam V stored value type
+ * @tparam V stored value type, or void for a set of intervals, whose iterators and query results yield Interval<T>
  */
 template<typename T, typename V>
 class IntervalTree {
-    friend class IntervalTreeResult<T, V>;
+    template <typename, typename, size_t>
+    friend class IntervalTreeResult;
+    friend class StabbingCursor<T, V>;
+    template <typename, typename, typename>
+    friend class AggregatingIntervalTree;
 public:
+    /** interval-value pair, or Interval<T> if V is void */
+    using value_type = typename IntervalTreeEntry<T, V>::type;
+    /** V, or a placeholder type if V is void */
+    using mapped_type = typename IntervalTreeEntry<T, V>::mapped_type;
+    using const_iterator = typename std::vector<value_type>::const_iterator;
+
     IntervalTree() = default;
 
     ~IntervalTree() = default;
@@ -85,43 +522,257 @@ public:
     IntervalTree &operator=(IntervalTree &&other) noexcept;
 
     template<typename ForwardIt>
-    IntervalTree(ForwardIt begin, ForwardIt end);
+    IntervalTree(ForwardIt begin, ForwardIt end, BuildPolicy policy = BuildPolicy::Auto);
 
     /**
-     * Compute an interval tree with the given list of interval-value pairs.
+     * Compute an interval tree with the given list of interval-value pairs, or of intervals if V is void.
      * @param intervals a collection of interval-value pairs where each `Interval(a, b)` represents the half-open interval [a, b).
-     * Consequently, b must be greater than a.
+     * Consequently, pairs with b <= a contain no points; they are stored, but never returned by a query.
+     * @param policy how to lay out the intervals; the choice is reported by stats()
+     * @throws std::length_error if the tree would hold more than max_size() intervals; the tree is left unchanged
      */
     template<typename ForwardIt>
-    void build(ForwardIt begin, ForwardIt end);
+    void build(ForwardIt begin, ForwardIt end, BuildPolicy policy = BuildPolicy::Auto);
 
     /**
      * Insert a single new value at the given interval. Note that this is a non-rebalancing tree, so if constructing a new tree
      * from a large number of elements, use build().
-     * @param interval new interval (with positive length)
+     * @param interval new interval (one without positive length is stored, but never returned by a query)
      * @param value value to store at the new interval
+     * @throws std::length_error if the tree already holds max_size() intervals; the tree is left unchanged
+     */
+    void insert(const Interval<T> &interval, const mapped_type &value);
+
+    /** insert() for a tree without values (V = void) */
+    void insert(const Interval<T> &interval);
+
+    /** the largest number of intervals a tree can hold, bounded by its 32 bit indices */
+    static constexpr size_t max_size() {
+        return std::numeric_limits<index_type>::max();
+    }
+
+    /**
+     * Find a stored interval with exactly the given endpoints, in O(log n). Intervals without positive length are kept
+     * out of the sorted indices, so looking one of those up scans all intervals.
+     * @param interval
+     * @return the earliest inserted pair with that interval, or cend() if there is none
+     */
+    const_iterator find(const Interval<T> &interval) const;
+
+    /**
+     * Overwrite the value stored at the given interval if find() locates one, otherwise insert() it. A new interval
+     * costs as much as insert(), which shifts the sorted indices and is therefore linear in size(), if with a small
+     * constant; only overwriting an existing value is O(log n).
+     * @return the pair holding the value, and whether it was inserted
+     */
+    std::pair<const_iterator, bool>
+    insert_or_assign(const Interval<T> &interval, const mapped_type &value);
+
+    /**
+     * Edit a stored value in place, leaving its interval and every index untouched, so handles and query results stay
+     * valid. Summaries set by summarize() are recomputed for the edited value.
+     * @param handle an iterator to the pair to edit, as returned by find(), insert_or_assign() or cbegin()
+     * @param fn called as fn(value) with a mutable reference to the stored value
      */
-    void insert(const Interval<T> &interval, const V &value);
+    template<typename Fn>
+    void modify(const_iterator handle, Fn fn);
 
 
     /**
      * Find all intervals intersecting with the query point. If the interval endpoints are a, b, return true if
      * a <= val < b
+     * @tparam InlineHits number of hits the result holds without allocating
      * @param val query point
      * @return start and end forward iterators to solution pairs of intervals and values.
      */
-    IntervalTreeResult<T, V> query(T val) const;
+    template<size_t InlineHits = 4>
+    IntervalTreeResult<T, V, InlineHits> query(T val) const;
 
     /**
      * Find all intervals overlapping with query interval
+     * @tparam InlineHits number of hits the result holds without allocating
+     * @param interval
+     */
+    template<size_t InlineHits = 4>
+    IntervalTreeResult<T, V, InlineHits> query(const Interval<T> &interval) const;
+
+    /**
+     * Remembers the search positions of the previous query along its path and in the global start order, so that
+     * the next query near the same point can resume its searches there instead of starting from scratch.
+     * A hint never changes query results; it may be reused for any number of queries on one tree.
+     */
+    class QueryHint {
+        friend class IntervalTree<T, V>;
+        /** search position within the center list of the node at each depth of the last path */
+        std::vector<size_t> path_positions_;
+        /** position in index_sorted_by_start_ of the first interval starting after the last range query's start */
+        size_t start_position_ = 0;
+    };
+
+    /**
+     * Find all intervals intersecting with the query point, starting each search where the previous query using the same
+     * hint ended. Nearby consecutive queries thus cost little more than their hits.
+     * @tparam InlineHits number of hits the result holds without allocating
+     * @param val query point
+     * @param hint positions of the previous query, updated for the next one
+     */
+    template<size_t InlineHits = 4>
+    IntervalTreeResult<T, V, InlineHits> query(T val, QueryHint &hint) const;
+
+    /**
+     * Find all intervals overlapping with query interval, starting each search where the previous query using the same
+     * hint ended
+     * @tparam InlineHits number of hits the result holds without allocating
+     * @param interval
+     * @param hint positions of the previous query, updated for the next one
+     */
+    template<size_t InlineHits = 4>
+    IntervalTreeResult<T, V, InlineHits> query(const Interval<T> &interval, QueryHint &hint) const;
+
+    /**
+     * Precompute a 64 bit summary of every stored value, such as a category or tenant bitmask, which filtered queries
+     * test against their mask. Every node also stores the union of the summaries below it and of each run of
+     * summary_block_size center entries, so that filtered queries skip whole subtrees and runs that cannot match.
+     * Summaries are kept up to date by build() and insert() until clear() is called.
+     * @param summary_fn called as summary_fn(value) on each stored value, returning a uint64_t
+     */
+    template<typename SummaryFn>
+    void summarize(SummaryFn summary_fn);
+
+    /**
+     * Find all intervals containing the query point whose summary shares at least one bit with mask.
+     * Without a prior call to summarize(), every interval containing the point matches.
+     * @tparam InlineHits number of hits the result holds without allocating
+     * @param val query point
+     * @param mask bits of which at least one must be set in a hit's summary
+     */
+    template<size_t InlineHits = 4>
+    IntervalTreeResult<T, V, InlineHits> query(T val, uint64_t mask) const;
+
+    /**
+     * Find all intervals overlapping with query interval whose summary shares at least one bit with mask
+     * @tparam InlineHits number of hits the result holds without allocating
+     * @param interval
+     * @param mask bits of which at least one must be set in a hit's summary
+     */
+    template<size_t InlineHits = 4>
+    IntervalTreeResult<T, V, InlineHits> query(const Interval<T> &interval, uint64_t mask) const;
+
+    /**
+     * Find the k highest priority intervals containing the query point. Hits are ranked as they are found, keeping only
+     * the current best k, so the remaining ones are never collected or sorted; every hit is still visited, so with
+     * priorities known in advance, prioritize() and the overload without key_fn are faster.
+     * @tparam InlineHits number of hits the result holds without allocating
+     * @param val query point
+     * @param k maximum number of hits to return
+     * @param key_fn priority of a hit, called as key_fn(pair) on each interval-value pair containing val; higher is better
+     * @return up to k hits, highest priority first
+     */
+    template<size_t InlineHits = 4, typename KeyFn>
+    IntervalTreeResult<T, V, InlineHits> query_top_k(T val, size_t k, KeyFn key_fn) const;
+
+    /**
+     * Precompute the priority of every stored interval for query_top_k(val, k). Every node also keeps a max-tree over
+     * the greatest priority of each run of summary_block_size center entries, so that the search opens only the runs
+     * that can still hold one of the best k hits. Priorities are kept up to date by build(), insert() and modify()
+     * until clear() is called.
+     * @param priority_fn called as priority_fn(pair) on each interval-value pair, returning a priority convertible to
+     * double; higher is better
+     */
+    template<typename PriorityFn>
+    void prioritize(PriorityFn priority_fn);
+
+    /**
+     * Find the k highest priority intervals containing the query point, by the priorities set by prioritize(). On a
+     * tree this takes O(log n) steps to find the hits' runs in the center lists, and then opens runs in order of their
+     * greatest priority until no unopened run can beat the k-th best hit, so it costs O((log n + k) log n) however many
+     * intervals contain val. Without a prior call to prioritize(), all hits have the same priority.
+     * @tparam InlineHits number of hits the result holds without allocating
+     * @param val query point
+     * @param k maximum number of hits to return
+     * @return up to k hits, highest priority first
+     */
+    template<size_t InlineHits = 4>
+    IntervalTreeResult<T, V, InlineHits> query_top_k(T val, size_t k) const;
+
+    /**
+     * Find all intervals containing at least one of a set of query points, each reported once however many of the
+     * points it contains. The points are sorted and the tree is traversed once, splitting the points between the
+     * children of each node, so the cost grows with the number of distinct hits rather than with the total over
+     * all points.
+     * @tparam InlineHits number of hits the result holds without allocating
+     * @param first start of the query points, in any order
+     * @param last end of the query points
+     */
+    template<size_t InlineHits = 4, typename InputIt>
+    IntervalTreeResult<T, V, InlineHits> query_any_of(InputIt first, InputIt last) const;
+
+    /**
+     * Find all intervals intersecting with the query point, writing the index of each hit instead of a pointer to it.
+     * Indices refer to positions in [cbegin(), cend()), i.e. the order in which intervals were added.
+     * @param val query point
+     * @param out output iterator accepting uint32_t indices
+     * @return output iterator past the last written index
+     */
+    template<typename OutputIt>
+    OutputIt query_ids(T val, OutputIt out) const;
+
+    /**
+     * Find the indices of all intervals overlapping with query interval. Each index is written once.
+     * @param interval
+     * @param out output iterator accepting uint32_t indices
+     * @return output iterator past the last written index
+     */
+    template<typename OutputIt>
+    OutputIt query_ids(const Interval<T> &interval, OutputIt out) const;
+
+    /**
+     * Find all intervals containing the query point, as at most one run per tree node visited
+     * @param val
+     * @return runs of interval indices covering every hit once
+     */
+    IntervalTreeRuns<T, V> query_runs(T val) const;
+
+    /**
+     * Find all intervals overlapping with query interval; those starting inside it form a single run however many
+     * there are
      * @param interval
+     * @return runs of interval indices covering every hit once
+     */
+    IntervalTreeRuns<T, V> query_runs(const Interval<T> &interval) const;
+
+    /**
+     * Find all intervals containing each of a batch of query points, or overlapping each of a batch of query
+     * intervals, with the same results as query(). Groups of query points descend the tree in lockstep, prefetching
+     * each query's next node while the others are processed, so that independent cache misses overlap. Query
+     * intervals are instead sorted by start and swept through the global endpoint orders, sharing the work between
+     * neighboring queries, for a total cost of O((n + q) log n + k) for q queries and k hits.
+     * Hits of different queries are interleaved.
+     * @param first start of the query points or Interval<T> query intervals
+     * @param last end of the queries
+     * @param callback called as callback(i, pair) for every interval-value pair matching the i-th query
      */
-    IntervalTreeResult<T, V> query(const Interval<T> &interval) const;
+    template<typename InputIt, typename Callback>
+    void query_batch(InputIt first, InputIt last, Callback callback) const;
+
+    /**
+     * Locate positions in the start order with a piecewise linear model of the start keys instead of a binary search,
+     * which pays off when the starts are close to uniformly distributed, such as timestamps. Every segment predicts
+     * the position of its keys within max_error, and lookups finish with an exponential search from the prediction.
+     * The model is refit by build(), and by insert() once a fraction of the intervals is new, until clear() is called.
+     * @param max_error error bound of the segments; 0 turns the model off
+     */
+    void set_learned_index(size_t max_error);
 
     size_t size() const;
 
-    typename std::vector<std::pair<Interval<T>, V>>::const_iterator cbegin() const;
-    typename std::vector<std::pair<Interval<T>, V>>::const_iterator cend() const;
+    /**
+     * Describe the current layout, the decision taken by the last build and the shape of the tree
+     */
+    IntervalTreeStats stats() const;
+
+    const_iterator cbegin() const;
+    const_iterator cend() const;
 
     /**
      * Clears all data and resets the interval tree
@@ -129,140 +780,1390 @@ public:
     void clear();
 
 private:
+    /** 32 bit indices into intervals_ halve the footprint of the sorted indices; query_ids() exposes the same width */
+    using index_type = uint32_t;
     struct TreeNode;
-    std::unique_ptr<TreeNode> root_;
-    std::vector<std::pair<Interval<T>, V>> intervals_;
-    std::vector<size_t> index_sorted_by_start_;
-    std::vector<size_t> index_sorted_by_end_;
-};
 
-/* Definitions */
+    static const Interval<T> &interval_of(const value_type &entry) {
+        return IntervalTreeEntry<T, V>::interval(entry);
+    }
 
-template<typename T, typename V>
-IntervalTree<T, V>::IntervalTree(const IntervalTree &other) {
-    root_ = other.root_->clone();
-    intervals_ = other.intervals_;
-    index_sorted_by_start_ = other.index_sorted_by_start_;
-    index_sorted_by_end_ = other.index_sorted_by_end_;
-}
+    static const mapped_type &value_of(const value_type &entry) {
+        return IntervalTreeEntry<T, V>::value(entry);
+    }
 
-template<typename T, typename V>
-IntervalTree<T, V>::IntervalTree(IntervalTree &&other) noexcept {
-    root_ = std::move(other.root_);
-    intervals_ = std::move(other.intervals_);
-    index_sorted_by_start_ = std::move(other.index_sorted_by_start_);
-    index_sorted_by_end_ = std::move(other.index_sorted_by_end_);
-}
+    /** the body of both insert() overloads */
+    void insert_entry(value_type entry);
 
-template<typename T, typename V>
-IntervalTree<T, V> &IntervalTree<T, V>::operator=(const IntervalTree &other) {
-    if (this != &other) {
-        root_ = other.root_->clone();
-        intervals_ = other.intervals_;
-        index_sorted_by_start_ = other.index_sorted_by_start_;
-        index_sorted_by_end_ = other.index_sorted_by_end_;
+    /** collections with fewer intervals than this are stored flat and scanned linearly instead of building a tree */
+    static constexpr size_t flat_size_threshold = 256;
+
+    /** number of consecutive center or start order entries sharing one summary mask */
+    static constexpr size_t summary_block_size = 16;
+
+    /**
+     * call visit(indices[i]) for every i in [begin, end) whose summary shares a bit with mask, skipping the blocks of
+     * summary_block_size entries whose combined summary in block_masks does not
+     */
+    template<typename F>
+    static void visit_summarized(const index_type *indices, const std::vector<uint64_t> &block_masks,
+                                 size_t begin, size_t end, const std::vector<uint64_t> &summaries, uint64_t mask, F &visit);
+
+    static void compute_block_masks(const index_type *indices, size_t size, const std::vector<uint64_t> &summaries,
+                                    std::vector<uint64_t> &block_masks);
+
+    /** recompute every summary and the masks derived from them */
+    void update_summaries();
+
+    /**
+     * Fill tree with a max-tree over the greatest priority of each block of summary_block_size entries of indices: the
+     * root is tree[1], the children of tree[j] are tree[2 j] and tree[2 j + 1], and the leaves are the blocks, padded
+     * with -infinity to a power of two
+     */
+    static void compute_priority_tree(const index_type *indices, size_t size, const std::vector<double> &priorities,
+                                      std::vector<double> &tree);
+
+    /** recompute every priority and the trees derived from them */
+    void update_priorities();
+
+    /** the k highest priority indices offered so far, kept as a min-heap on priority */
+    template<typename Key>
+    class TopK;
+
+    /** recompute the summary of one stored value after it changed, adding its new bits to the masks above it */
+    void update_summary(index_type index);
+
+    /** number of queries advanced together by query_batch() */
+    static constexpr size_t batch_group_size = 16;
+
+    static void prefetch(const void *ptr) {
+#if defined(__GNUC__) || defined(__clang__)
+        __builtin_prefetch(ptr);
+#else
+        (void) ptr;
+#endif
+    }
+
+    /** whether the half-open interval contains no points; such intervals are kept out of every index */
+    static bool is_empty(const Interval<T> &interval) {
+        return !(interval.start < interval.end);
+    }
+
+    /** a point in [a, b] computed without overflowing, for a <= b */
+    static T midpoint(T a, T b) {
+        return midpoint(a, b, std::is_integral<T>());
+    }
+
+    static T midpoint(T a, T b, std::true_type) {
+        //the distance fits the unsigned type, and half of it fits T
+        using unsigned_type = typename std::make_unsigned<T>::type;
+        unsigned_type distance = static_cast<unsigned_type>(static_cast<unsigned_type>(b) - static_cast<unsigned_type>(a));
+        return static_cast<T>(a + static_cast<T>(distance / 2));
+    }
+
+    static T midpoint(T a, T b, std::false_type) {
+        T half_distance = (b - a) / 2;
+        //halving each endpoint first only loses precision, but cannot overflow when the distance does
+        return std::isfinite(half_distance) ? a + half_distance : a / 2 + b / 2;
+    }
+
+    /**
+     * Number of leading keys among n sorted keys that are < val, or <= val if Upper is set, found by exponential search
+     * outwards from hint followed by a binary search, so the cost grows with the distance between hint and the result.
+     * @param key_at returns the i-th key
+     */
+    template<bool Upper, typename KeyAt>
+    static size_t gallop_bound(size_t n, size_t hint, T val, KeyAt key_at);
+
+    /**
+     * Lay out the start keys of index_sorted_by_start_ in Eytzinger (breadth-first) order, 1-based, so that a binary
+     * search reads its probes from the front of the array and can prefetch the descendants several levels ahead
+     */
+    void build_eytzinger(std::vector<T> &layout) const;
+
+    /**
+     * Number of keys in the index laid out by build_eytzinger() that are < val, or <= val if Upper is set
+     */
+    template<bool Upper>
+    static size_t eytzinger_bound(const std::vector<T> &layout, T val);
+
+    /** position in sorted order of the key in slot k of an Eytzinger layout of n keys */
+    static size_t eytzinger_rank(size_t k, size_t n);
+
+    static size_t floor_log2(size_t x) {
+#if defined(__GNUC__) || defined(__clang__)
+        return std::numeric_limits<unsigned long long>::digits - 1 - __builtin_clzll(x);
+#else
+        size_t result = 0;
+        while (x >>= 1) result++;
+        return result;
+#endif
+    }
+
+    /** position of the lowest set bit of a nonzero word */
+    static size_t lowest_bit(uint64_t word) {
+#if defined(__GNUC__) || defined(__clang__)
+        return __builtin_ctzll(word);
+#else
+        size_t bit = 0;
+        while (!((word >> bit) & 1)) bit++;
+        return bit;
+#endif
+    }
+
+    /** (re)compute the Eytzinger layout and the learned model of the start order */
+    void update_searches();
+
+    /**
+     * update_searches() is deferred until more than 1/search_rebuild_ratio of the intervals were inserted since its
+     * last call; until then, start_bound() adds the number of smaller keys in stale_starts_ to the positions it finds
+     */
+    static constexpr size_t search_rebuild_ratio = 8;
+
+    /** keys from first_key on are predicted at first_position + slope * (key - first_key) */
+    struct LearnedSegment {
+        T first_key;
+        double slope;
+        size_t first_position;
+    };
+
+    /** fit learned_segments_ to the start order with a shrinking cone per segment, if learned_max_error_ is set */
+    void fit_learned_index();
+
+    /** position in the start order that the learned model predicts for val */
+    size_t predict_start_position(T val) const;
+
+    /** number of intervals in index_sorted_by_start_ starting before val, or at or before val if Upper is set */
+    template<bool Upper>
+    size_t start_bound(T val) const;
+
+    /**
+     * Position in index_sorted_by_start_ of the first entry with the endpoints of interval, or past the last such entry
+     * if After is set. Entries with equal starts are ordered by end and then by index, so this is a binary search.
+     */
+    template<bool After>
+    size_t start_order_position(const Interval<T> &interval) const;
+
+    /** (re)compute either the tree or the flat arrays for all of intervals_, according to policy_ */
+    void build_structure();
+
+    /** sample the input properties stored in decision_ and choose the split rule (and layout, for BuildPolicy::Auto) */
+    void choose_layout();
+
+    /** call f(index) for every interval containing val */
+    template<typename F>
+    void visit(T val, F &f) const;
+
+    /** visit() over the flat arrays, used when there is no tree */
+    template<typename F>
+    void visit_flat(T val, F &f) const;
+
+    /** visit() over the flat arrays of the disjoint layout */
+    template<typename F>
+    void visit_disjoint(T val, F &f) const;
+
+    /** position in the flat arrays of the disjoint layout of the interval containing val, or their size if none does */
+    size_t find_disjoint(T val) const;
+
+    /** call f(index) exactly once for every interval containing at least one of the sorted points */
+    template<typename F>
+    void visit_any_of(const std::vector<T> &points, F &f) const;
+
+    /** call emit(first, last) for runs of indices that together hold every interval containing val once */
+    template<typename G>
+    void visit_runs(T val, G &emit) const;
+
+    /** visit() resuming the searches from hint */
+    template<typename F>
+    void visit(T val, QueryHint &hint, F &f) const;
+
+    /** visit() resuming the searches from hint */
+    template<typename F>
+    void visit(const Interval<T> &interval, QueryHint &hint, F &f) const;
+
+    /** call f(index) for every interval containing val whose summary shares a bit with mask */
+    template<typename F>
+    void visit(T val, uint64_t mask, F &f) const;
+
+    /** call f(index) once for every interval overlapping the query interval whose summary shares a bit with mask */
+    template<typename F>
+    void visit(const Interval<T> &interval, uint64_t mask, F &f) const;
+
+    /** query_batch() for query points */
+    template<typename InputIt, typename Callback>
+    void query_batch(InputIt first, InputIt last, Callback &callback, std::false_type) const;
+
+    /** query_batch() for query intervals */
+    template<typename InputIt, typename Callback>
+    void query_batch(InputIt first, InputIt last, Callback &callback, std::true_type) const;
+
+    /** call f(index) exactly once for every interval overlapping the query interval */
+    template<typename F>
+    void visit(const Interval<T> &interval, F &f) const;
+
+    std::unique_ptr<TreeNode> root_;
+    std::vector<value_type> intervals_;
+    std::vector<index_type> index_sorted_by_start_;
+    /** only built for a tree; the flat layouts answer every query from the start order */
+    std::vector<index_type> index_sorted_by_end_;
+    /** keys of index_sorted_by_start_ in Eytzinger order, as of the last update_searches(); only built for a tree */
+    std::vector<T> eytzinger_by_start_;
+    /** sorted start keys inserted since the last update_searches(), which the two searches above do not count */
+    std::vector<T> stale_starts_;
+    /** error bound set by set_learned_index() and the segments of the model, empty if it is off */
+    size_t learned_max_error_ = 0;
+    std::vector<LearnedSegment> learned_segments_;
+    /** endpoints of the intervals in index_sorted_by_start_, in the same order; only populated without a tree */
+    std::vector<T> flat_starts_;
+    std::vector<T> flat_ends_;
+    BuildPolicy policy_ = BuildPolicy::Auto;
+    /** layout, split and sampled input properties of the last build; the node statistics are filled in by stats() */
+    IntervalTreeStats decision_;
+    /** function set by summarize(), the resulting summary of each interval, and block masks over index_sorted_by_start_ */
+    std::function<uint64_t(const mapped_type &)> summary_fn_;
+    std::vector<uint64_t> summaries_;
+    std::vector<uint64_t> start_block_masks_;
+    /** function set by prioritize() and the resulting priority of each interval */
+    std::function<double(const value_type &)> priority_fn_;
+    std::vector<double> priorities_;
+};
+
+/* Definitions */
+
+template<typename T, typename V>
+IntervalTree<T, V>::IntervalTree(const IntervalTree &other) {
+    root_ = other.root_ ? other.root_->clone() : nullptr;
+    intervals_ = other.intervals_;
+    index_sorted_by_start_ = other.index_sorted_by_start_;
+    index_sorted_by_end_ = other.index_sorted_by_end_;
+    eytzinger_by_start_ = other.eytzinger_by_start_;
+    stale_starts_ = other.stale_starts_;
+    learned_max_error_ = other.learned_max_error_;
+    learned_segments_ = other.learned_segments_;
+    flat_starts_ = other.flat_starts_;
+    flat_ends_ = other.flat_ends_;
+    policy_ = other.policy_;
+    decision_ = other.decision_;
+    summary_fn_ = other.summary_fn_;
+    summaries_ = other.summaries_;
+    start_block_masks_ = other.start_block_masks_;
+    priority_fn_ = other.priority_fn_;
+    priorities_ = other.priorities_;
+}
+
+template<typename T, typename V>
+IntervalTree<T, V>::IntervalTree(IntervalTree &&other) noexcept {
+    root_ = std::move(other.root_);
+    intervals_ = std::move(other.intervals_);
+    index_sorted_by_start_ = std::move(other.index_sorted_by_start_);
+    index_sorted_by_end_ = std::move(other.index_sorted_by_end_);
+    eytzinger_by_start_ = std::move(other.eytzinger_by_start_);
+    stale_starts_ = std::move(other.stale_starts_);
+    learned_max_error_ = other.learned_max_error_;
+    learned_segments_ = std::move(other.learned_segments_);
+    flat_starts_ = std::move(other.flat_starts_);
+    flat_ends_ = std::move(other.flat_ends_);
+    policy_ = other.policy_;
+    decision_ = other.decision_;
+    summary_fn_ = std::move(other.summary_fn_);
+    summaries_ = std::move(other.summaries_);
+    start_block_masks_ = std::move(other.start_block_masks_);
+    priority_fn_ = std::move(other.priority_fn_);
+    priorities_ = std::move(other.priorities_);
+    //the layout was moved along with the nodes, so the source has to go back to the empty layout
+    other.clear();
+}
+
+template<typename T, typename V>
+IntervalTree<T, V> &IntervalTree<T, V>::operator=(const IntervalTree &other) {
+    if (this != &other) {
+        root_ = other.root_ ? other.root_->clone() : nullptr;
+        intervals_ = other.intervals_;
+        index_sorted_by_start_ = other.index_sorted_by_start_;
+        index_sorted_by_end_ = other.index_sorted_by_end_;
+        eytzinger_by_start_ = other.eytzinger_by_start_;
+        stale_starts_ = other.stale_starts_;
+        learned_max_error_ = other.learned_max_error_;
+        learned_segments_ = other.learned_segments_;
+        flat_starts_ = other.flat_starts_;
+        flat_ends_ = other.flat_ends_;
+        policy_ = other.policy_;
+        decision_ = other.decision_;
+        summary_fn_ = other.summary_fn_;
+        summaries_ = other.summaries_;
+        start_block_masks_ = other.start_block_masks_;
+        priority_fn_ = other.priority_fn_;
+        priorities_ = other.priorities_;
+    }
+    return *this;
+}
+
+template<typename T, typename V>
+IntervalTree<T, V> &IntervalTree<T, V>::operator=(IntervalTree &&other) noexcept {
+    if (this != &other) {
+        root_ = std::move(other.root_);
+        intervals_ = std::move(other.intervals_);
+        index_sorted_by_start_ = std::move(other.index_sorted_by_start_);
+        index_sorted_by_end_ = std::move(other.index_sorted_by_end_);
+        eytzinger_by_start_ = std::move(other.eytzinger_by_start_);
+        stale_starts_ = std::move(other.stale_starts_);
+        learned_max_error_ = other.learned_max_error_;
+        learned_segments_ = std::move(other.learned_segments_);
+        flat_starts_ = std::move(other.flat_starts_);
+        flat_ends_ = std::move(other.flat_ends_);
+        policy_ = other.policy_;
+        decision_ = other.decision_;
+        summary_fn_ = std::move(other.summary_fn_);
+        summaries_ = std::move(other.summaries_);
+        start_block_masks_ = std::move(other.start_block_masks_);
+        priority_fn_ = std::move(other.priority_fn_);
+        priorities_ = std::move(other.priorities_);
+        other.clear();
+    }
+    return *this;
+}
+
+template<typename T, typename V>
+template<typename ForwardIt>
+IntervalTree<T, V>::IntervalTree(ForwardIt begin, ForwardIt end, BuildPolicy policy) {
+    build(begin, end, policy);
+}
+
+template<typename T, typename V>
+template<typename ForwardIt>
+void IntervalTree<T, V>::build(ForwardIt begin, ForwardIt end, BuildPolicy policy) {
+    size_t added = std::distance(begin, end);
+    if (added > max_size() - intervals_.size()) {
+        throw std::length_error("IntervalTree::build: too many intervals");
+    }
+    policy_ = policy;
+    intervals_.reserve(intervals_.size() + added);
+    for (auto it = begin; it != end; it++) {
+        intervals_.push_back(*it);
+    }
+    index_sorted_by_start_.clear();
+    index_sorted_by_start_.reserve(intervals_.size());
+    for (size_t i = 0; i < intervals_.size(); i++) {
+        if (!is_empty(interval_of(intervals_[i]))) {
+            index_sorted_by_start_.push_back(i);
+        }
+    }
+    //equal starts are ordered by end and then by index, so that find() can binary search for both endpoints
+    std::sort(index_sorted_by_start_.begin(), index_sorted_by_start_.end(), [&](index_type a, index_type b) {
+        const Interval<T> &x = interval_of(intervals_[a]);
+        const Interval<T> &y = interval_of(intervals_[b]);
+        if (x.start < y.start) return true;
+        if (y.start < x.start) return false;
+        if (x.end < y.end) return true;
+        if (y.end < x.end) return false;
+        return a < b;
+    });
+    build_structure();
+}
+
+template<typename T, typename V>
+void IntervalTree<T, V>::build_structure() {
+    choose_layout();
+    if (index_sorted_by_start_.empty()) {
+        decision_.layout = IntervalTreeLayout::Flat;
+    }
+    if (decision_.layout != IntervalTreeLayout::Tree) {
+        root_.reset(nullptr);
+        std::vector<index_type>().swap(index_sorted_by_end_);
+        flat_starts_.resize(index_sorted_by_start_.size());
+        flat_ends_.resize(index_sorted_by_start_.size());
+        for (size_t i = 0; i < index_sorted_by_start_.size(); i++) {
+            flat_starts_[i] = interval_of(intervals_[index_sorted_by_start_[i]]).start;
+            flat_ends_[i] = interval_of(intervals_[index_sorted_by_start_[i]]).end;
+        }
+    } else {
+        std::vector<T>().swap(flat_starts_);
+        std::vector<T>().swap(flat_ends_);
+        index_sorted_by_end_ = index_sorted_by_start_;
+        std::sort(index_sorted_by_end_.begin(), index_sorted_by_end_.end(), IntervalComp<T, V>(intervals_, false));
+        root_ = std::make_unique<TreeNode>(intervals_, index_sorted_by_start_, decision_.split);
+    }
+    update_searches();
+    if (summary_fn_) {
+        update_summaries();
+    }
+    if (priority_fn_) {
+        update_priorities();
+    }
+}
+
+template<typename T, typename V>
+void IntervalTree<T, V>::choose_layout() {
+    decision_ = IntervalTreeStats();
+    decision_.integral = std::is_integral<T>::value;
+    //sample at most this many evenly spaced intervals, leaving out the empty ones, which no query returns
+    const size_t max_samples = 1024;
+    size_t stride = std::max<size_t>(1, index_sorted_by_start_.size() / max_samples);
+    std::vector<double> lengths;
+    std::vector<double> midpoints;
+    std::vector<std::pair<T, int>> events;
+    T t_min = std::numeric_limits<T>::max();
+    T t_max = std::numeric_limits<T>::lowest();
+    for (size_t i = 0; i < index_sorted_by_start_.size(); i += stride) {
+        const Interval<T> &interval = interval_of(intervals_[index_sorted_by_start_[i]]);
+        t_min = std::min(t_min, interval.start);
+        t_max = std::max(t_max, interval.end);
+        lengths.push_back(static_cast<double>(interval.end) - static_cast<double>(interval.start));
+        midpoints.push_back((static_cast<double>(interval.start) + static_cast<double>(interval.end)) / 2);
+        events.emplace_back(interval.start, 1);
+        events.emplace_back(interval.end, -1);
+    }
+    if (!lengths.empty() && t_min < t_max) {
+        double extent = static_cast<double>(t_max) - static_cast<double>(t_min);
+        std::nth_element(lengths.begin(), lengths.begin() + lengths.size() / 2, lengths.end());
+        double median_length = lengths[lengths.size() / 2];
+        decision_.length_spread = median_length > 0 ? extent / median_length : std::numeric_limits<double>::infinity();
+        std::nth_element(midpoints.begin(), midpoints.begin() + midpoints.size() / 2, midpoints.end());
+        double center = (static_cast<double>(t_min) + static_cast<double>(t_max)) / 2;
+        decision_.extent_skew = std::abs(midpoints[midpoints.size() / 2] - center) / (extent / 2);
+        //ends sort before starts at the same coordinate, as the intervals are half-open
+        std::sort(events.begin(), events.end());
+        long depth = 0;
+        for (const auto &event : events) {
+            depth += event.second;
+            decision_.sample_max_nesting = std::max(decision_.sample_max_nesting, static_cast<size_t>(std::max(0L, depth)));
+        }
+    }
+    bool disjoint = true;
+    for (size_t i = 1; i < index_sorted_by_start_.size() && disjoint; i++) {
+        disjoint = interval_of(intervals_[index_sorted_by_start_[i - 1]]).end <=
+                   interval_of(intervals_[index_sorted_by_start_[i]]).start;
+    }
+    if (policy_ == BuildPolicy::Auto) {
+        if (disjoint) {
+            decision_.layout = IntervalTreeLayout::Disjoint;
+        } else {
+            decision_.layout = intervals_.size() < flat_size_threshold ? IntervalTreeLayout::Flat : IntervalTreeLayout::Tree;
+        }
+        //the midpoint split needs about log2(length_spread) levels and the median split about log2(size()), and
+        //a skewed extent leaves the midpoint split's top levels with one nearly empty side
+        bool median = decision_.extent_skew > 0.5 ||
+                      decision_.length_spread > 4.0 * static_cast<double>(index_sorted_by_start_.size());
+        decision_.split = median ? IntervalTreeSplit::Median : IntervalTreeSplit::Midpoint;
+    } else {
+        decision_.layout = IntervalTreeLayout::Tree;
+        decision_.split = policy_ == BuildPolicy::Median ? IntervalTreeSplit::Median : IntervalTreeSplit::Midpoint;
+    }
+}
+
+template<typename T, typename V>
+void IntervalTree<T, V>::insert(const Interval<T> &interval, const mapped_type &value) {
+    insert_entry(value_type(interval, value));
+}
+
+template<typename T, typename V>
+void IntervalTree<T, V>::insert(const Interval<T> &interval) {
+    static_assert(std::is_void<V>::value, "insert() needs a value unless V is void");
+    insert_entry(interval);
+}
+
+template<typename T, typename V>
+void IntervalTree<T, V>::insert_entry(value_type entry) {
+    if (intervals_.size() >= max_size()) {
+        throw std::length_error("IntervalTree::insert: too many intervals");
+    }
+    intervals_.push_back(std::move(entry));
+    index_type index = intervals_.size()-1;
+    Interval<T> interval = interval_of(intervals_.back());
+    if (summary_fn_) {
+        summaries_.push_back(summary_fn_(value_of(intervals_.back())));
+    }
+    if (priority_fn_) {
+        priorities_.push_back(priority_fn_(intervals_.back()));
+    }
+    if (is_empty(interval)) {
+        return;
+    }
+    //the new index is the largest, so it goes after every entry with the same endpoints
+    size_t pos = start_order_position<true>(interval);
+    index_sorted_by_start_.insert(index_sorted_by_start_.begin() + pos, index);
+    if (decision_.layout == IntervalTreeLayout::Tree) {
+        index_sorted_by_end_.insert(std::upper_bound(index_sorted_by_end_.begin(), index_sorted_by_end_.end(), index,
+                                                     IntervalComp<T, V>(intervals_, false)), index);
+    }
+    stale_starts_.insert(std::upper_bound(stale_starts_.begin(), stale_starts_.end(), interval.start), interval.start);
+    if (stale_starts_.size() > index_sorted_by_start_.size() / search_rebuild_ratio) {
+        update_searches();
+    }
+    bool keep_flat = false;
+    switch (decision_.layout) {
+        case IntervalTreeLayout::Tree:
+            root_->insert(intervals_, index);
+            if (summary_fn_) {
+                root_->add_summary(intervals_, summaries_, index);
+                compute_block_masks(index_sorted_by_start_.data(), index_sorted_by_start_.size(), summaries_, start_block_masks_);
+            }
+            if (priority_fn_) {
+                root_->update_priority(intervals_, priorities_, index);
+            }
+            return;
+        case IntervalTreeLayout::Flat:
+            keep_flat = policy_ == BuildPolicy::Auto && intervals_.size() < flat_size_threshold;
+            break;
+        case IntervalTreeLayout::Disjoint:
+            //the neighbors in start order are the only intervals the new one could overlap
+            keep_flat = (pos == 0 || flat_ends_[pos - 1] <= interval.start) &&
+                        (pos == flat_starts_.size() || interval.end <= flat_starts_[pos]);
+            break;
+    }
+    if (keep_flat) {
+        flat_starts_.insert(flat_starts_.begin() + pos, interval.start);
+        flat_ends_.insert(flat_ends_.begin() + pos, interval.end);
+        if (summary_fn_) {
+            compute_block_masks(index_sorted_by_start_.data(), index_sorted_by_start_.size(), summaries_, start_block_masks_);
+        }
+    } else {
+        build_structure();
+    }
+}
+
+template<typename T, typename V>
+typename IntervalTree<T, V>::const_iterator IntervalTree<T, V>::find(const Interval<T> &interval) const {
+    if (is_empty(interval)) {
+        //empty intervals are kept out of the sorted indices
+        for (auto it = intervals_.cbegin(); it != intervals_.cend(); ++it) {
+            if (interval_of(*it).start == interval.start && interval_of(*it).end == interval.end) return it;
+        }
+        return intervals_.cend();
+    }
+    size_t pos = start_order_position<false>(interval);
+    if (pos < index_sorted_by_start_.size()) {
+        //the first entry with these endpoints has the smallest index among them
+        const Interval<T> &found = interval_of(intervals_[index_sorted_by_start_[pos]]);
+        if (!(interval.start < found.start) && !(interval.end < found.end)) {
+            return intervals_.cbegin() + index_sorted_by_start_[pos];
+        }
+    }
+    return intervals_.cend();
+}
+
+template<typename T, typename V>
+template<bool After>
+size_t IntervalTree<T, V>::start_order_position(const Interval<T> &interval) const {
+    //only the entries sharing the start need to be compared by end
+    auto first = index_sorted_by_start_.begin() + start_bound<false>(interval.start);
+    auto last = index_sorted_by_start_.begin() + start_bound<true>(interval.start);
+    return std::partition_point(first, last, [&](index_type i) {
+        return After ? !(interval.end < interval_of(intervals_[i]).end) : interval_of(intervals_[i]).end < interval.end;
+    }) - index_sorted_by_start_.begin();
+}
+
+template<typename T, typename V>
+std::pair<typename IntervalTree<T, V>::const_iterator, bool>
+IntervalTree<T, V>::insert_or_assign(const Interval<T> &interval, const mapped_type &value) {
+    static_assert(!std::is_void<V>::value, "insert_or_assign() needs a tree with values");
+    auto it = find(interval);
+    if (it != intervals_.cend()) {
+        modify(it, [&](V &stored) { stored = value; });
+        return std::make_pair(it, false);
+    }
+    insert(interval, value);
+    return std::make_pair(intervals_.cend() - 1, true);
+}
+
+template<typename T, typename V>
+template<typename Fn>
+void IntervalTree<T, V>::modify(const_iterator handle, Fn fn) {
+    static_assert(!std::is_void<V>::value, "modify() needs a tree with values");
+    index_type index = static_cast<index_type>(handle - intervals_.cbegin());
+    fn(intervals_[index].second);
+    if (summary_fn_) {
+        update_summary(index);
+    }
+    if (priority_fn_) {
+        priorities_[index] = priority_fn_(intervals_[index]);
+        if (root_ && !is_empty(interval_of(intervals_[index]))) {
+            root_->update_priority(intervals_, priorities_, index);
+        }
+    }
+}
+
+template<typename T, typename V>
+void IntervalTree<T, V>::build_eytzinger(std::vector<T> &layout) const {
+    size_t n = index_sorted_by_start_.size();
+    layout.resize(n + 1);
+    //an in-order walk of the implicit tree visits its slots in sorted order
+    size_t k = 1;
+    while (2 * k <= n) k = 2 * k;
+    for (size_t rank = 0; rank < n; rank++) {
+        layout[k] = interval_of(intervals_[index_sorted_by_start_[rank]]).start;
+        if (2 * k + 1 <= n) {
+            //the successor is the leftmost node of the right subtree
+            k = 2 * k + 1;
+            while (2 * k <= n) k = 2 * k;
+        } else {
+            //climb past the ancestors whose right subtree is complete, then to the in-order successor
+            while (k & 1) k >>= 1;
+            k >>= 1;
+        }
+    }
+}
+
+template<typename T, typename V>
+template<bool Upper>
+size_t IntervalTree<T, V>::eytzinger_bound(const std::vector<T> &layout, T val) {
+    size_t n = layout.empty() ? 0 : layout.size() - 1;
+    //descendants this many levels down share a cache line, so they are fetched while the levels in between are read
+    const size_t lookahead = std::max<size_t>(1, 64 / sizeof(T));
+    size_t k = 1;
+    while (k <= n) {
+        if (k * lookahead <= n) {
+            prefetch(layout.data() + k * lookahead);
+        }
+        bool right = Upper ? !(val < layout[k]) : layout[k] < val;
+        k = 2 * k + right;
+    }
+    //the result is the last node where the search turned left
+    while (k & 1) k >>= 1;
+    k >>= 1;
+    return k == 0 ? n : eytzinger_rank(k, n);
+}
+
+template<typename T, typename V>
+size_t IntervalTree<T, V>::eytzinger_rank(size_t k, size_t n) {
+    //the rank the slot would have if the last level were full
+    size_t height = floor_log2(n);
+    size_t depth = floor_log2(k);
+    size_t full_rank = ((2 * (k - (size_t(1) << depth)) + 1) << (height - depth)) - 1;
+    //the last level fills from the left and its slots take every other rank, so only the missing ones among the
+    //first (full_rank + 1) / 2 of them shift the rank down
+    size_t last_level = n - ((size_t(1) << height) - 1);
+    size_t leaves_before = (full_rank + 1) / 2;
+    return full_rank - (leaves_before > last_level ? leaves_before - last_level : 0);
+}
+
+template<typename T, typename V>
+void IntervalTree<T, V>::update_searches() {
+    if (decision_.layout == IntervalTreeLayout::Tree) {
+        build_eytzinger(eytzinger_by_start_);
+    } else {
+        std::vector<T>().swap(eytzinger_by_start_);
+    }
+    fit_learned_index();
+    stale_starts_.clear();
+}
+
+template<typename T, typename V>
+void IntervalTree<T, V>::fit_learned_index() {
+    learned_segments_.clear();
+    if (learned_max_error_ == 0) return;
+    const double max_error = static_cast<double>(learned_max_error_);
+    //the slopes that keep every point of the current segment within max_error of its prediction
+    double min_slope = 0;
+    double max_slope = std::numeric_limits<double>::infinity();
+    auto close_segment = [&]() {
+        learned_segments_.back().slope = std::isinf(max_slope) ? 0 : (min_slope + max_slope) / 2;
+    };
+    for (size_t i = 0; i < index_sorted_by_start_.size(); i++) {
+        T key = interval_of(intervals_[index_sorted_by_start_[i]]).start;
+        //each key is fitted at its first position; lookups of duplicates gallop over the rest
+        if (!learned_segments_.empty()) {
+            const LearnedSegment &segment = learned_segments_.back();
+            double dx = static_cast<double>(key) - static_cast<double>(segment.first_key);
+            if (!(dx > 0)) continue;
+            double dy = static_cast<double>(i - segment.first_position);
+            double lo = std::max(min_slope, (dy - max_error) / dx);
+            double hi = std::min(max_slope, (dy + max_error) / dx);
+            if (lo <= hi) {
+                min_slope = lo;
+                max_slope = hi;
+                continue;
+            }
+            close_segment();
+        }
+        learned_segments_.push_back(LearnedSegment{key, 0, i});
+        min_slope = 0;
+        max_slope = std::numeric_limits<double>::infinity();
+    }
+    if (!learned_segments_.empty()) {
+        close_segment();
+    }
+}
+
+template<typename T, typename V>
+size_t IntervalTree<T, V>::predict_start_position(T val) const {
+    auto it = std::upper_bound(learned_segments_.begin(), learned_segments_.end(), val,
+                               [](T v, const LearnedSegment &segment) { return v < segment.first_key; });
+    if (it == learned_segments_.begin()) return 0;
+    --it;
+    double position = static_cast<double>(it->first_position) +
+                      it->slope * (static_cast<double>(val) - static_cast<double>(it->first_key));
+    //also rejects NaN
+    if (!(position < static_cast<double>(index_sorted_by_start_.size()))) return index_sorted_by_start_.size();
+    return static_cast<size_t>(position);
+}
+
+template<typename T, typename V>
+template<bool Upper>
+size_t IntervalTree<T, V>::start_bound(T val) const {
+    if (decision_.layout != IntervalTreeLayout::Tree && learned_segments_.empty()) {
+        //the flat arrays hold the start keys contiguously and in order
+        return (Upper ? std::upper_bound(flat_starts_.begin(), flat_starts_.end(), val) :
+                        std::lower_bound(flat_starts_.begin(), flat_starts_.end(), val)) - flat_starts_.begin();
+    }
+    //both searches count the keys present at the last update_searches(), so the newer ones are counted separately
+    size_t stale = (Upper ? std::upper_bound(stale_starts_.begin(), stale_starts_.end(), val) :
+                            std::lower_bound(stale_starts_.begin(), stale_starts_.end(), val)) - stale_starts_.begin();
+    if (learned_segments_.empty()) {
+        return eytzinger_bound<Upper>(eytzinger_by_start_, val) + stale;
+    }
+    return gallop_bound<Upper>(index_sorted_by_start_.size(), predict_start_position(val) + stale, val,
+                               [&](size_t i) { return interval_of(intervals_[index_sorted_by_start_[i]]).start; });
+}
+
+template<typename T, typename V>
+template<bool Upper, typename KeyAt>
+size_t IntervalTree<T, V>::gallop_bound(size_t n, size_t hint, T val, KeyAt key_at) {
+    //whether the i-th key belongs past the result
+    auto past = [&](size_t i) { return Upper ? val < key_at(i) : !(key_at(i) < val); };
+    hint = std::min(hint, n);
+    //narrow the result down to [lo, hi] with steps doubling away from hint
+    size_t lo;
+    size_t hi;
+    size_t step = 1;
+    if (hint < n && !past(hint)) {
+        lo = hint + 1;
+        hi = lo;
+        while (hi < n && !past(hi)) {
+            lo = hi + 1;
+            hi = lo + step;
+            step *= 2;
+        }
+        hi = std::min(hi, n);
+    } else {
+        hi = hint;
+        lo = hint;
+        while (lo > 0 && past(lo - 1)) {
+            hi = lo - 1;
+            lo = hi >= step ? hi - step : 0;
+            step *= 2;
+        }
+    }
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (past(mid)) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+    return lo;
+}
+
+template<typename T, typename V>
+template<typename SummaryFn>
+void IntervalTree<T, V>::summarize(SummaryFn summary_fn) {
+    static_assert(!std::is_void<V>::value, "summarize() needs a tree with values");
+    summary_fn_ = summary_fn;
+    update_summaries();
+}
+
+template<typename T, typename V>
+void IntervalTree<T, V>::update_summaries() {
+    summaries_.resize(intervals_.size());
+    for (size_t i = 0; i < intervals_.size(); i++) {
+        summaries_[i] = summary_fn_(value_of(intervals_[i]));
+    }
+    compute_block_masks(index_sorted_by_start_.data(), index_sorted_by_start_.size(), summaries_, start_block_masks_);
+    if (root_) {
+        root_->update_summaries(summaries_);
+    }
+}
+
+template<typename T, typename V>
+void IntervalTree<T, V>::update_summary(index_type index) {
+    uint64_t summary = summary_fn_(value_of(intervals_[index]));
+    if (summary == summaries_[index]) return;
+    //the masks are unions that only filter out candidates, so bits the value lost can stay in them
+    summaries_[index] = summary;
+    const Interval<T> &interval = interval_of(intervals_[index]);
+    if (is_empty(interval)) return;
+    //entries with the same endpoints follow each other in the order of their indices
+    auto first = index_sorted_by_start_.begin() + start_order_position<false>(interval);
+    auto last = index_sorted_by_start_.begin() + start_order_position<true>(interval);
+    size_t pos = std::lower_bound(first, last, index) - index_sorted_by_start_.begin();
+    start_block_masks_[pos / summary_block_size] |= summary;
+    if (root_) {
+        root_->add_summary(intervals_, summaries_, index);
+    }
+}
+
+template<typename T, typename V>
+void IntervalTree<T, V>::compute_block_masks(const index_type *indices, size_t size, const std::vector<uint64_t> &summaries,
+                                             std::vector<uint64_t> &block_masks) {
+    block_masks.assign((size + summary_block_size - 1) / summary_block_size, 0);
+    for (size_t i = 0; i < size; i++) {
+        block_masks[i / summary_block_size] |= summaries[indices[i]];
+    }
+}
+
+template<typename T, typename V>
+template<typename PriorityFn>
+void IntervalTree<T, V>::prioritize(PriorityFn priority_fn) {
+    priority_fn_ = priority_fn;
+    update_priorities();
+}
+
+template<typename T, typename V>
+void IntervalTree<T, V>::update_priorities() {
+    priorities_.resize(intervals_.size());
+    for (size_t i = 0; i < intervals_.size(); i++) {
+        priorities_[i] = priority_fn_(intervals_[i]);
+    }
+    if (root_) {
+        root_->update_priorities(priorities_);
+    }
+}
+
+template<typename T, typename V>
+void IntervalTree<T, V>::compute_priority_tree(const index_type *indices, size_t size, const std::vector<double> &priorities,
+                                               std::vector<double> &tree) {
+    size_t blocks = (size + summary_block_size - 1) / summary_block_size;
+    size_t leaves = 1;
+    while (leaves < blocks) leaves *= 2;
+    tree.assign(2 * leaves, -std::numeric_limits<double>::infinity());
+    for (size_t i = 0; i < size; i++) {
+        double &leaf = tree[leaves + i / summary_block_size];
+        leaf = std::max(leaf, priorities[indices[i]]);
+    }
+    for (size_t j = leaves - 1; j > 0; j--) {
+        tree[j] = std::max(tree[2 * j], tree[2 * j + 1]);
+    }
+}
+
+template<typename T, typename V>
+template<typename F>
+void IntervalTree<T, V>::visit_summarized(const index_type *indices, const std::vector<uint64_t> &block_masks,
+                                          size_t begin, size_t end, const std::vector<uint64_t> &summaries, uint64_t mask, F &visit) {
+    for (size_t block = begin / summary_block_size; block * summary_block_size < end; block++) {
+        if (!(block_masks[block] & mask)) continue;
+        size_t block_end = std::min(end, (block + 1) * summary_block_size);
+        for (size_t i = std::max(begin, block * summary_block_size); i < block_end; i++) {
+            if (summaries[indices[i]] & mask) {
+                visit(indices[i]);
+            }
+        }
+    }
+}
+
+template<typename T, typename V>
+template<typename F>
+void IntervalTree<T, V>::visit(T val, F &f) const {
+    switch (decision_.layout) {
+        case IntervalTreeLayout::Tree:
+            root_->query(val, f);
+            break;
+        case IntervalTreeLayout::Flat:
+            visit_flat(val, f);
+            break;
+        case IntervalTreeLayout::Disjoint:
+            visit_disjoint(val, f);
+            break;
+    }
+}
+
+template<typename T, typename V>
+template<typename F>
+void IntervalTree<T, V>::visit_flat(T val, F &f) const {
+    const T *starts = flat_starts_.data();
+    const T *ends = flat_ends_.data();
+    size_t size = flat_starts_.size();
+    //the starts are sorted, so no chunk after one starting past val holds a hit
+    for (size_t chunk = 0; chunk < size && !(val < starts[chunk]); chunk += 64) {
+        //compare a whole chunk before calling f, so that the compares run as vector instructions
+        size_t n = std::min<size_t>(size - chunk, 64);
+        uint64_t hits = KeyScan<T>::mask_less_equal(starts + chunk, n, val) & KeyScan<T>::mask_greater(ends + chunk, n, val);
+        for (; hits; hits &= hits - 1) {
+            f(index_sorted_by_start_[chunk + lowest_bit(hits)]);
+        }
+    }
+}
+
+template<typename T, typename V>
+template<typename F>
+void IntervalTree<T, V>::visit_disjoint(T val, F &f) const {
+    size_t i = find_disjoint(val);
+    if (i < flat_starts_.size()) {
+        f(index_sorted_by_start_[i]);
+    }
+}
+
+template<typename T, typename V>
+size_t IntervalTree<T, V>::find_disjoint(T val) const {
+    size_t n = flat_starts_.size();
+    if (n == 0) return n;
+    if (!learned_segments_.empty()) {
+        size_t i = gallop_bound<true>(n, predict_start_position(val), val, [&](size_t k) { return flat_starts_[k]; });
+        return i > 0 && val < flat_ends_[i - 1] ? i - 1 : n;
+    }
+    //branchless binary search for the last start <= val, landing on the first entry if there is none
+    const T *base = flat_starts_.data();
+    while (n > 1) {
+        size_t half = n / 2;
+        base = base[half] <= val ? base + half : base;
+        n -= half;
+    }
+    size_t i = base - flat_starts_.data();
+    return *base <= val && val < flat_ends_[i] ? i : flat_starts_.size();
+}
+
+template<typename T, typename V>
+template<typename G>
+void IntervalTree<T, V>::visit_runs(T val, G &emit) const {
+    const index_type *by_start = index_sorted_by_start_.data();
+    switch (decision_.layout) {
+        case IntervalTreeLayout::Tree:
+            for (const TreeNode *node = root_.get(); node; node = node->step_runs(val, emit)) {}
+            break;
+        case IntervalTreeLayout::Flat: {
+            //the flat arrays follow the start order, so consecutive hits extend the same run
+            size_t run_start = 0;
+            bool in_run = false;
+            for (size_t i = 0; i < flat_starts_.size(); i++) {
+                bool hit = flat_starts_[i] <= val && val < flat_ends_[i];
+                if (hit && !in_run) {
+                    run_start = i;
+                } else if (!hit && in_run) {
+                    emit(by_start + run_start, by_start + i);
+                }
+                in_run = hit;
+            }
+            if (in_run) {
+                emit(by_start + run_start, by_start + flat_starts_.size());
+            }
+            break;
+        }
+        case IntervalTreeLayout::Disjoint: {
+            size_t i = find_disjoint(val);
+            if (i < flat_starts_.size()) {
+                emit(by_start + i, by_start + i + 1);
+            }
+            break;
+        }
+    }
+}
+
+template<typename T, typename V>
+template<typename F>
+void IntervalTree<T, V>::visit(const Interval<T> &interval, F &f) const {
+    //intervals enclosing the query start
+    visit(interval.start, f);
+    //remaining overlaps start strictly inside the query interval; these are disjoint from the ones above,
+    //so no deduplication is needed
+    auto it = index_sorted_by_start_.begin() + start_bound<true>(interval.start);
+    for (; it != index_sorted_by_start_.end() && interval_of(intervals_[*it]).start < interval.end; it++) {
+        f(*it);
+    }
+}
+
+template<typename T, typename V>
+template<typename F>
+void IntervalTree<T, V>::visit(T val, QueryHint &hint, F &f) const {
+    if (!root_) {
+        visit(val, f);
+        return;
+    }
+    size_t depth = 0;
+    for (const TreeNode *node = root_.get(); node; depth++) {
+        if (hint.path_positions_.size() <= depth) {
+            hint.path_positions_.push_back(0);
+        }
+        node = node->step(val, f, &hint.path_positions_[depth]);
+    }
+}
+
+template<typename T, typename V>
+template<typename F>
+void IntervalTree<T, V>::visit(const Interval<T> &interval, QueryHint &hint, F &f) const {
+    visit(interval.start, hint, f);
+    size_t n = index_sorted_by_start_.size();
+    size_t i = gallop_bound<true>(n, hint.start_position_, interval.start,
+                                  [&](size_t k) { return interval_of(intervals_[index_sorted_by_start_[k]]).start; });
+    hint.start_position_ = i;
+    for (; i < n && interval_of(intervals_[index_sorted_by_start_[i]]).start < interval.end; i++) {
+        f(index_sorted_by_start_[i]);
+    }
+}
+
+template<typename T, typename V>
+template<size_t InlineHits>
+IntervalTreeResult<T, V, InlineHits> IntervalTree<T, V>::query(T val, QueryHint &hint) const {
+    IntervalTreeResult<T, V, InlineHits> result;
+    auto collect = [&](size_t i) { result.results_.push_back(&intervals_[i]); };
+    visit(val, hint, collect);
+    return result;
+}
+
+template<typename T, typename V>
+template<size_t InlineHits>
+IntervalTreeResult<T, V, InlineHits> IntervalTree<T, V>::query(const Interval<T> &interval, QueryHint &hint) const {
+    IntervalTreeResult<T, V, InlineHits> result;
+    auto collect = [&](size_t i) { result.results_.push_back(&intervals_[i]); };
+    visit(interval, hint, collect);
+    return result;
+}
+
+template<typename T, typename V>
+template<typename F>
+void IntervalTree<T, V>::visit(T val, uint64_t mask, F &f) const {
+    if (!summary_fn_) {
+        visit(val, f);
+    } else if (root_) {
+        for (const TreeNode *node = root_.get(); node && (node->summary_->subtree_mask & mask);
+             node = node->step(summaries_, val, mask, f)) {}
+    } else {
+        auto filter = [&](size_t i) {
+            if (summaries_[i] & mask) f(i);
+        };
+        visit(val, filter);
+    }
+}
+
+template<typename T, typename V>
+template<typename F>
+void IntervalTree<T, V>::visit(const Interval<T> &interval, uint64_t mask, F &f) const {
+    if (!summary_fn_) {
+        visit(interval, f);
+        return;
+    }
+    visit(interval.start, mask, f);
+    size_t begin = start_bound<true>(interval.start);
+    size_t end = std::max(begin, start_bound<false>(interval.end));
+    visit_summarized(index_sorted_by_start_.data(), start_block_masks_, begin, end, summaries_, mask, f);
+}
+
+template<typename T, typename V>
+template<size_t InlineHits>
+IntervalTreeResult<T, V, InlineHits> IntervalTree<T, V>::query(T val, uint64_t mask) const {
+    IntervalTreeResult<T, V, InlineHits> result;
+    auto collect = [&](size_t i) { result.results_.push_back(&intervals_[i]); };
+    visit(val, mask, collect);
+    return result;
+}
+
+template<typename T, typename V>
+template<size_t InlineHits>
+IntervalTreeResult<T, V, InlineHits> IntervalTree<T, V>::query(const Interval<T> &interval, uint64_t mask) const {
+    IntervalTreeResult<T, V, InlineHits> result;
+    auto collect = [&](size_t i) { result.results_.push_back(&intervals_[i]); };
+    visit(interval, mask, collect);
+    return result;
+}
+
+template<typename T, typename V>
+template<size_t InlineHits>
+IntervalTreeResult<T, V, InlineHits> IntervalTree<T, V>::query(T val) const {
+    IntervalTreeResult<T, V, InlineHits> result;
+    auto collect = [&](size_t i) { result.results_.push_back(&intervals_[i]); };
+    visit(val, collect);
+    return result;
+}
+
+template<typename T, typename V>
+template<size_t InlineHits>
+IntervalTreeResult<T, V, InlineHits> IntervalTree<T, V>::query(const Interval<T> &interval) const {
+    IntervalTreeResult<T, V, InlineHits> result;
+    auto collect = [&](size_t i) { result.results_.push_back(&intervals_[i]); };
+    visit(interval, collect);
+    return result;
+}
+
+template<typename T, typename V>
+template<typename Key>
+class IntervalTree<T, V>::TopK {
+public:
+    explicit TopK(size_t k) : k_(k) {
+        best_.reserve(k);
+    }
+
+    /** whether k indices were offered, so that only higher priorities than worst() can still get in */
+    bool full() const {
+        return best_.size() == k_;
+    }
+
+    const Key &worst() const {
+        return best_.front().first;
+    }
+
+    void offer(Key key, index_type index) {
+        if (best_.size() < k_) {
+            best_.emplace_back(std::move(key), index);
+            std::push_heap(best_.begin(), best_.end(), lower_priority);
+        } else if (best_.front().first < key) {
+            std::pop_heap(best_.begin(), best_.end(), lower_priority);
+            best_.back() = std::make_pair(std::move(key), index);
+            std::push_heap(best_.begin(), best_.end(), lower_priority);
+        }
+    }
+
+    /** add the kept indices to result, highest priority first */
+    template<size_t InlineHits>
+    void collect(const std::vector<value_type> &intervals, IntervalTreeResult<T, V, InlineHits> &result) {
+        std::sort_heap(best_.begin(), best_.end(), lower_priority);
+        for (const auto &entry : best_) {
+            result.results_.push_back(&intervals[entry.second]);
+        }
+    }
+
+private:
+    static bool lower_priority(const std::pair<Key, index_type> &a, const std::pair<Key, index_type> &b) {
+        return b.first < a.first;
+    }
+
+    size_t k_;
+    std::vector<std::pair<Key, index_type>> best_;
+};
+
+template<typename T, typename V>
+template<size_t InlineHits, typename KeyFn>
+IntervalTreeResult<T, V, InlineHits> IntervalTree<T, V>::query_top_k(T val, size_t k, KeyFn key_fn) const {
+    using key_type = typename std::decay<decltype(key_fn(intervals_.front()))>::type;
+    IntervalTreeResult<T, V, InlineHits> result;
+    if (k == 0) return result;
+    TopK<key_type> best(k);
+    auto offer = [&](size_t i) { best.offer(key_fn(intervals_[i]), static_cast<index_type>(i)); };
+    visit(val, offer);
+    best.collect(intervals_, result);
+    return result;
+}
+
+template<typename T, typename V>
+template<size_t InlineHits>
+IntervalTreeResult<T, V, InlineHits> IntervalTree<T, V>::query_top_k(T val, size_t k) const {
+    IntervalTreeResult<T, V, InlineHits> result;
+    if (k == 0) return result;
+    TopK<double> best(k);
+    if (!priority_fn_ || !root_) {
+        //a flat layout holds few intervals, and a disjoint one at most one hit
+        auto offer = [&](size_t i) { best.offer(priority_fn_ ? priorities_[i] : 0.0, static_cast<index_type>(i)); };
+        visit(val, offer);
+        best.collect(intervals_, result);
+        return result;
+    }
+    //the hits at each node on the path of val form one run of a center list, searched through that list's max-tree
+    struct Run {
+        const index_type *indices;
+        size_t begin;
+        size_t end;
+        const std::vector<double> *tree;
+    };
+    //a subtree of a max-tree, covering blocks [first_block, last_block) of a run's list
+    struct Candidate {
+        double bound;
+        size_t run;
+        size_t slot;
+        size_t first_block;
+        size_t last_block;
+    };
+    std::vector<Run> runs;
+    std::vector<Candidate> candidates;
+    auto lower_bound = [](const Candidate &a, const Candidate &b) { return a.bound < b.bound; };
+    auto push = [&](size_t run, size_t slot, size_t first_block, size_t last_block) {
+        //skip the subtrees holding none of the run's entries
+        const Run &r = runs[run];
+        if (first_block * summary_block_size < r.end && r.begin < last_block * summary_block_size) {
+            candidates.push_back(Candidate{(*r.tree)[slot], run, slot, first_block, last_block});
+            std::push_heap(candidates.begin(), candidates.end(), lower_bound);
+        }
+    };
+    const TreeNode *node = root_.get();
+    auto add_run = [&](const index_type *first, const index_type *last) {
+        bool by_end = first >= node->sorted_by_end();
+        const index_type *indices = by_end ? node->sorted_by_end() : node->sorted_by_start();
+        const std::vector<double> &tree = by_end ? node->summary_->end_priority_tree : node->summary_->start_priority_tree;
+        runs.push_back(Run{indices, static_cast<size_t>(first - indices), static_cast<size_t>(last - indices), &tree});
+        push(runs.size() - 1, 1, 0, tree.size() / 2);
+    };
+    for (; node; node = node->step_runs(val, add_run)) {}
+    while (!candidates.empty()) {
+        std::pop_heap(candidates.begin(), candidates.end(), lower_bound);
+        Candidate candidate = candidates.back();
+        candidates.pop_back();
+        //every remaining candidate is bounded by this one
+        if (best.full() && !(best.worst() < candidate.bound)) break;
+        const Run &run = runs[candidate.run];
+        if (candidate.last_block - candidate.first_block == 1) {
+            size_t end = std::min(run.end, candidate.last_block * summary_block_size);
+            for (size_t i = std::max(run.begin, candidate.first_block * summary_block_size); i < end; i++) {
+                best.offer(priorities_[run.indices[i]], run.indices[i]);
+            }
+        } else {
+            size_t middle = (candidate.first_block + candidate.last_block) / 2;
+            push(candidate.run, 2 * candidate.slot, candidate.first_block, middle);
+            push(candidate.run, 2 * candidate.slot + 1, middle, candidate.last_block);
+        }
+    }
+    best.collect(intervals_, result);
+    return result;
+}
+
+template<typename T, typename V>
+template<size_t InlineHits, typename InputIt>
+IntervalTreeResult<T, V, InlineHits> IntervalTree<T, V>::query_any_of(InputIt first, InputIt last) const {
+    std::vector<T> points(first, last);
+    std::sort(points.begin(), points.end());
+    IntervalTreeResult<T, V, InlineHits> result;
+    auto collect = [&](size_t i) { result.results_.push_back(&intervals_[i]); };
+    visit_any_of(points, collect);
+    return result;
+}
+
+template<typename T, typename V>
+template<typename F>
+void IntervalTree<T, V>::visit_any_of(const std::vector<T> &points, F &f) const {
+    if (points.empty()) return;
+    switch (decision_.layout) {
+        case IntervalTreeLayout::Tree:
+            root_->query_any_of(intervals_, points.data(), points.data() + points.size(), f);
+            break;
+        case IntervalTreeLayout::Flat:
+            //an interval contains a point if the first point at or after its start lies before its end
+            for (size_t i = 0; i < flat_starts_.size(); i++) {
+                auto it = std::lower_bound(points.begin(), points.end(), flat_starts_[i]);
+                if (it != points.end() && *it < flat_ends_[i]) {
+                    f(index_sorted_by_start_[i]);
+                }
+            }
+            break;
+        case IntervalTreeLayout::Disjoint: {
+            //sorted points find their intervals in start order, so repeats are adjacent
+            size_t last = flat_starts_.size();
+            for (T point : points) {
+                size_t i = find_disjoint(point);
+                if (i < flat_starts_.size() && i != last) {
+                    f(index_sorted_by_start_[i]);
+                    last = i;
+                }
+            }
+            break;
+        }
     }
-    return *this;
 }
 
 template<typename T, typename V>
-IntervalTree<T, V> &IntervalTree<T, V>::operator=(IntervalTree &&other) noexcept {
-    if (this != &other) {
-        root_ = std::move(other.root_);
-        intervals_ = std::move(other.intervals_);
-        index_sorted_by_start_ = std::move(other.index_sorted_by_start_);
-        index_sorted_by_end_ = std::move(other.index_sorted_by_end_);
-    }
-    return *this;
+template<typename OutputIt>
+OutputIt IntervalTree<T, V>::query_ids(T val, OutputIt out) const {
+    auto write = [&](size_t i) { *out++ = static_cast<uint32_t>(i); };
+    visit(val, write);
+    return out;
 }
 
 template<typename T, typename V>
-template<typename ForwardIt>
-IntervalTree<T, V>::IntervalTree(ForwardIt begin, ForwardIt end) {
-    build(begin, end);
+template<typename OutputIt>
+OutputIt IntervalTree<T, V>::query_ids(const Interval<T> &interval, OutputIt out) const {
+    auto write = [&](size_t i) { *out++ = static_cast<uint32_t>(i); };
+    visit(interval, write);
+    return out;
 }
 
 template<typename T, typename V>
-template<typename ForwardIt>
-void IntervalTree<T, V>::build(ForwardIt begin, ForwardIt end) {
-    for (auto it = begin; it != end; it++) {
-        //if (it->first.start < it->first.end) {
-            intervals_.push_back(*it);
-        //}
-    }
-    index_sorted_by_start_.resize(intervals_.size());
-    index_sorted_by_end_.resize(intervals_.size());
-    std::iota(index_sorted_by_start_.begin(), index_sorted_by_start_.end(), 0);
-    std::iota(index_sorted_by_end_.begin(), index_sorted_by_end_.end(), 0);
-    std::sort(index_sorted_by_start_.begin(), index_sorted_by_start_.end(), [&](size_t a, size_t b) {return intervals_[a].first.start < intervals_[b].first.start;});
-    std::sort(index_sorted_by_end_.begin(), index_sorted_by_end_.end(), [&](size_t a, size_t b) {return intervals_[a].first.end < intervals_[b].first.end;});
-    std::vector<size_t> indices(intervals_.size());
-    std::iota(indices.begin(), indices.end(), 0);
-    root_ = std::make_unique<TreeNode>(intervals_, indices);
-}
-
-template<typename T, typename V>
-void IntervalTree<T, V>::insert(const Interval<T> &interval, const V &value) {
-    //if (interval.start >= interval.end) return;
-    intervals_.emplace_back(interval, value);
-    index_sorted_by_start_.push_back(intervals_.size()-1);
-    index_sorted_by_end_.push_back(intervals_.size()-1);
-    std::sort(index_sorted_by_start_.begin(), index_sorted_by_start_.end(), [&](size_t a, size_t b) {return intervals_[a].first.start < intervals_[b].first.start;});
-    std::sort(index_sorted_by_end_.begin(), index_sorted_by_end_.end(), [&](size_t a, size_t b) {return intervals_[a].first.end < intervals_[b].first.end;});
-    if (root_) {
-        root_->insert(intervals_, intervals_.size()-1);
-    } else {
-        root_ = std::make_unique<TreeNode>(intervals_, intervals_.size()-1);
-    }
+IntervalTreeRuns<T, V> IntervalTree<T, V>::query_runs(T val) const {
+    IntervalTreeRuns<T, V> result(intervals_);
+    auto emit = [&](const index_type *first, const index_type *last) { result.runs_.push_back({first, last}); };
+    visit_runs(val, emit);
+    return result;
 }
 
 template<typename T, typename V>
-IntervalTreeResult<T, V> IntervalTree<T, V>::query(T val) const {
-    IntervalTreeResult<T, V> result;
-    if (root_) {
-        root_->query(intervals_, val, result);
+IntervalTreeRuns<T, V> IntervalTree<T, V>::query_runs(const Interval<T> &interval) const {
+    IntervalTreeRuns<T, V> result = query_runs(interval.start);
+    //as in visit(const Interval<T> &), the remaining hits start strictly inside the query interval
+    size_t begin = start_bound<true>(interval.start);
+    size_t end = start_bound<false>(interval.end);
+    if (begin < end) {
+        result.runs_.push_back({index_sorted_by_start_.data() + begin, index_sorted_by_start_.data() + end});
     }
     return result;
 }
 
 template<typename T, typename V>
-IntervalTreeResult<T, V> IntervalTree<T, V>::query(const Interval<T> &interval) const {
-    IntervalTreeResult<T, V> result;
-    //find intervals enclosing this interval
-    if (root_) {
-        //std::vector<bool> flag(intervals_.size(), false);
-        std::unordered_set<const std::pair<Interval<T>, V> *> used;
-        root_->query(intervals_, interval.start, result);
-        for (auto ptr : result.results_) {
-            used.insert(ptr);
-        }
-        //find the smallest left endpoint greater than or equal to query left endpoint
-        {
-            auto it = std::lower_bound(index_sorted_by_start_.begin(), index_sorted_by_start_.end(), interval.start,
-                                       [&](size_t a, T val) { return intervals_[a].first.start < val; });
-            for (; it != index_sorted_by_start_.end(); it++) {
-                if (intervals_[*it].first.start < interval.end) {
-                    if (used.find(&intervals_[*it]) == used.end()) {
-                        result.results_.push_back(&intervals_[*it]);
-                        used.insert(&intervals_[*it]);
-                    }
-                }
-            }
+template<typename InputIt, typename Callback>
+void IntervalTree<T, V>::query_batch(InputIt first, InputIt last, Callback callback) const {
+    using query_type = typename std::decay<typename std::iterator_traits<InputIt>::value_type>::type;
+    query_batch(first, last, callback, std::is_same<query_type, Interval<T>>());
+}
+
+template<typename T, typename V>
+template<typename InputIt, typename Callback>
+void IntervalTree<T, V>::query_batch(InputIt first, InputIt last, Callback &callback, std::false_type) const {
+    if (!root_) {
+        for (size_t id = 0; first != last; first++, id++) {
+            auto report = [&](size_t i) { callback(id, intervals_[i]); };
+            visit(static_cast<T>(*first), report);
         }
-        {
-            auto it = std::upper_bound(index_sorted_by_end_.begin(), index_sorted_by_end_.end(), interval.start,
-                    [&] (T val, size_t b) {return val < intervals_[b].first.end;});
-            for (; it != index_sorted_by_end_.end(); it++) {
-                if (intervals_[*it].first.end < interval.end) {
-                    if (used.find(&intervals_[*it]) == used.end()) {
-                        result.results_.push_back(&intervals_[*it]);
-                        used.insert(&intervals_[*it]);
-                    }
+        return;
+    }
+    const TreeNode *nodes[batch_group_size];
+    T vals[batch_group_size];
+    size_t ids[batch_group_size];
+    size_t next_id = 0;
+    while (first != last) {
+        size_t active = 0;
+        for (; active < batch_group_size && first != last; active++, first++) {
+            nodes[active] = root_.get();
+            vals[active] = *first;
+            ids[active] = next_id++;
+        }
+        while (active > 0) {
+            //the nodes were prefetched during the previous round; now fetch the center list each query will scan
+            for (size_t j = 0; j < active; j++) {
+                prefetch(vals[j] <= nodes[j]->x_center_ ? nodes[j]->starts() : nodes[j]->ends());
+            }
+            for (size_t j = 0; j < active;) {
+                size_t id = ids[j];
+                auto report = [&](size_t i) { callback(id, intervals_[i]); };
+                const TreeNode *next = nodes[j]->step(vals[j], report);
+                if (next) {
+                    prefetch(next);
+                    nodes[j] = next;
+                    j++;
+                } else {
+                    //retire the finished query by moving the last active one into its slot
+                    active--;
+                    nodes[j] = nodes[active];
+                    vals[j] = vals[active];
+                    ids[j] = ids[active];
                 }
             }
         }
     }
-    return result;
+}
+
+template<typename T, typename V>
+template<typename InputIt, typename Callback>
+void IntervalTree<T, V>::query_batch(InputIt first, InputIt last, Callback &callback, std::true_type) const {
+    std::vector<Interval<T>> windows(first, last);
+    std::vector<size_t> order(windows.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&](size_t a, size_t b) { return windows[a].start < windows[b].start; });
+    //as in visit(const Interval<T> &), the hits are the intervals containing the window start, which the cursor tracks
+    //as it sweeps, and those starting strictly inside the window, found from a position that only moves forward
+    StabbingCursor<T, V> cursor(*this);
+    size_t n = index_sorted_by_start_.size();
+    auto start_at = [&](size_t i) { return interval_of(intervals_[index_sorted_by_start_[i]]).start; };
+    size_t position = 0;
+    for (size_t id : order) {
+        const Interval<T> &window = windows[id];
+        cursor.advance(window.start);
+        for (const auto *hit : cursor.active()) {
+            callback(id, *hit);
+        }
+        position = gallop_bound<true>(n, position, window.start, start_at);
+        for (size_t i = position; i < n && start_at(i) < window.end; i++) {
+            callback(id, intervals_[index_sorted_by_start_[i]]);
+        }
+    }
+}
+
+template<typename T, typename V>
+void IntervalTree<T, V>::set_learned_index(size_t max_error) {
+    learned_max_error_ = max_error;
+    update_searches();
 }
 
 template<typename T, typename V>
@@ -271,32 +2172,71 @@ size_t IntervalTree<T, V>::size() const {
 }
 
 
+template<typename T, typename V>
+IntervalTreeStats IntervalTree<T, V>::stats() const {
+    IntervalTreeStats stats = decision_;
+    stats.size = intervals_.size();
+    stats.learned_segments = learned_segments_.size();
+    if (root_) {
+        root_->collect_stats(stats, 1);
+    }
+    return stats;
+}
+
 template<typename T, typename V>
 void IntervalTree<T, V>::clear() {
     root_.reset(nullptr);
     intervals_.clear();
     index_sorted_by_start_.clear();
     index_sorted_by_end_.clear();
+    eytzinger_by_start_.clear();
+    stale_starts_.clear();
+    flat_starts_.clear();
+    flat_ends_.clear();
+    policy_ = BuildPolicy::Auto;
+    decision_ = IntervalTreeStats();
+    summary_fn_ = nullptr;
+    summaries_.clear();
+    priority_fn_ = nullptr;
+    priorities_.clear();
+    start_block_masks_.clear();
+    learned_max_error_ = 0;
+    learned_segments_.clear();
 }
 
 //result type
 
-template <typename T, typename V>
+template <typename T, typename V, size_t InlineHits>
 class IntervalTreeResult {
         friend class IntervalTree<T, V>::TreeNode;
         friend class IntervalTree<T, V>;
     public:
-        using value_type = std::pair<Interval<T>, V>;
-        struct Iterator {
-            friend class IntervalTreeResult<T, V>;
-            value_type operator*() {
-                return *(parent_.results_[index_]);
+        using value_type = typename IntervalTreeEntry<T, V>::type;
+        /**
+         * Random access iterator over the hits. Dereferencing yields a reference into the tree's storage, so no
+         * interval-value pair is copied while iterating.
+         */
+        class Iterator {
+            friend class IntervalTreeResult;
+        public:
+            using iterator_category = std::random_access_iterator_tag;
+            using value_type = typename IntervalTreeResult::value_type;
+            using difference_type = std::ptrdiff_t;
+            using pointer = const value_type *;
+            using reference = const value_type &;
+
+            Iterator() = default;
+            reference operator*() const {
+                return **ptr_;
+            }
+            pointer operator->() const {
+                return *ptr_;
             }
-            const value_type *operator->() {
-                return parent_.results_[index_];
+            reference operator[](difference_type n) const {
+                return *ptr_[n];
             }
             Iterator &operator++() {
-                index_++;
+                ++ptr_;
                 return *this;
             }
             Iterator operator++(int) {
@@ -304,171 +2244,773 @@ class IntervalTreeResult {
                 ++*this;
                 return copy;
             }
-            bool operator==(const Iterator &other) {
-                return index_ == other.index_;
+            Iterator &operator--() {
+                --ptr_;
+                return *this;
+            }
+            Iterator operator--(int) {
+                Iterator copy = *this;
+                --*this;
+                return copy;
+            }
+            Iterator &operator+=(difference_type n) {
+                ptr_ += n;
+                return *this;
+            }
+            Iterator &operator-=(difference_type n) {
+                ptr_ -= n;
+                return *this;
+            }
+            Iterator operator+(difference_type n) const {
+                return Iterator(ptr_ + n);
+            }
+            friend Iterator operator+(difference_type n, const Iterator &it) {
+                return it + n;
+            }
+            Iterator operator-(difference_type n) const {
+                return Iterator(ptr_ - n);
+            }
+            difference_type operator-(const Iterator &other) const {
+                return ptr_ - other.ptr_;
+            }
+            bool operator==(const Iterator &other) const {
+                return ptr_ == other.ptr_;
+            }
+            bool operator!=(const Iterator &other) const {
+                return ptr_ != other.ptr_;
+            }
+            bool operator<(const Iterator &other) const {
+                return ptr_ < other.ptr_;
+            }
+            bool operator>(const Iterator &other) const {
+                return ptr_ > other.ptr_;
             }
-            bool operator!=(const Iterator &other) {
-                return index_ != other.index_;
+            bool operator<=(const Iterator &other) const {
+                return ptr_ <= other.ptr_;
+            }
+            bool operator>=(const Iterator &other) const {
+                return ptr_ >= other.ptr_;
             }
         private:
-            Iterator(size_t index, const IntervalTreeResult<T, V> &parent) : index_(index), parent_(parent) {}
-            size_t index_;
-            const IntervalTreeResult<T, V> &parent_;
+            explicit Iterator(const value_type *const *ptr) : ptr_(ptr) {}
+            const value_type *const *ptr_ = nullptr;
         };
+        using iterator = Iterator;
+        using const_iterator = Iterator;
         /** start iterator of results */
         Iterator begin() const {
-            return Iterator(0, *this);
+            return Iterator(results_.data());
         }
         /** past-the-end iterator of results */
         Iterator end() const {
-            return Iterator(results_.size(), *this);
+            return Iterator(results_.data() + results_.size());
         }
         /** number of hits */
         size_t size() const {
             return results_.size();
         }
+        bool empty() const {
+            return results_.empty();
+        }
+        /** i-th hit, by reference */
+        const value_type &operator[](size_t i) const {
+            return *results_[i];
+        }
+        const value_type &front() const {
+            return *results_.front();
+        }
+        const value_type &back() const {
+            return *results_.back();
+        }
         void sort() {
-            std::sort(results_.begin(), results_.end(), [](const value_type* a, const value_type* b) {return a->first.start < b->first.start;});
+            std::sort(results_.begin(), results_.end(), [](const value_type* a, const value_type* b) {
+                return IntervalTreeEntry<T, V>::interval(*a).start < IntervalTreeEntry<T, V>::interval(*b).start;
+            });
+        }
+    private:
+        /**
+         * Pointer list that keeps the first InlineHits entries in place and moves everything to a heap vector
+         * once it outgrows them, so queries with few hits never allocate.
+         */
+        class Storage {
+        public:
+            Storage() = default;
+            Storage(const Storage &other) = default;
+            Storage &operator=(const Storage &other) = default;
+            /** a spilled source keeps its size but loses its heap vector, so it is reset to empty */
+            Storage(Storage &&other) noexcept : inline_(other.inline_), heap_(std::move(other.heap_)), size_(other.size_) {
+                other.heap_.clear();
+                other.size_ = 0;
+            }
+            Storage &operator=(Storage &&other) noexcept {
+                if (this != &other) {
+                    inline_ = other.inline_;
+                    heap_ = std::move(other.heap_);
+                    size_ = other.size_;
+                    other.heap_.clear();
+                    other.size_ = 0;
+                }
+                return *this;
+            }
+            void push_back(const value_type *ptr) {
+                if (heap_.empty()) {
+                    if (size_ < InlineHits) {
+                        inline_[size_++] = ptr;
+                        return;
+                    }
+                    heap_.reserve(2 * InlineHits + 1);
+                    heap_.assign(inline_.begin(), inline_.begin() + size_);
+                }
+                heap_.push_back(ptr);
+                size_++;
+            }
+            const value_type **data() {
+                return heap_.empty() ? inline_.data() : heap_.data();
+            }
+            const value_type *const *data() const {
+                return heap_.empty() ? inline_.data() : heap_.data();
+            }
+            const value_type **begin() {
+                return data();
+            }
+            const value_type **end() {
+                return data() + size_;
+            }
+            size_t size() const {
+                return size_;
+            }
+            bool empty() const {
+                return size_ == 0;
+            }
+            const value_type *operator[](size_t i) const {
+                return data()[i];
+            }
+            const value_type *front() const {
+                return data()[0];
+            }
+            const value_type *back() const {
+                return data()[size_ - 1];
+            }
+        private:
+            std::array<const value_type *, InlineHits> inline_{};
+            std::vector<const value_type *> heap_;
+            size_t size_ = 0;
+        };
+        Storage results_;
+};
+
+//run-encoded result type
+
+template <typename T, typename V>
+class IntervalTreeRuns {
+        friend class IntervalTree<T, V>;
+    public:
+        using value_type = typename IntervalTreeEntry<T, V>::type;
+
+        /** consecutive entries of one of the tree's index lists, holding indices as written by query_ids() */
+        struct Run {
+            const uint32_t *first;
+            const uint32_t *last;
+            size_t size() const {
+                return last - first;
+            }
+        };
+
+        /**
+         * Forward iterator over the hits, expanding one run at a time
+         */
+        class Iterator {
+            friend class IntervalTreeRuns;
+        public:
+            using iterator_category = std::forward_iterator_tag;
+            using value_type = typename IntervalTreeRuns::value_type;
+            using difference_type = std::ptrdiff_t;
+            using pointer = const value_type *;
+            using reference = const value_type &;
+
+            Iterator() = default;
+            reference operator*() const {
+                return (*intervals_)[*pos_];
+            }
+            pointer operator->() const {
+                return &(*intervals_)[*pos_];
+            }
+            Iterator &operator++() {
+                if (++pos_ == run_->last) {
+                    ++run_;
+                    pos_ = run_ != runs_end_ ? run_->first : nullptr;
+                }
+                return *this;
+            }
+            Iterator operator++(int) {
+                Iterator copy = *this;
+                ++*this;
+                return copy;
+            }
+            bool operator==(const Iterator &other) const {
+                return run_ == other.run_ && pos_ == other.pos_;
+            }
+            bool operator!=(const Iterator &other) const {
+                return !(*this == other);
+            }
+        private:
+            Iterator(const std::vector<value_type> *intervals, const Run *run, const Run *runs_end) :
+                    intervals_(intervals), run_(run), runs_end_(runs_end), pos_(run != runs_end ? run->first : nullptr) {}
+            const std::vector<value_type> *intervals_ = nullptr;
+            const Run *run_ = nullptr;
+            const Run *runs_end_ = nullptr;
+            const uint32_t *pos_ = nullptr;
+        };
+        using iterator = Iterator;
+        using const_iterator = Iterator;
+        /** start iterator of results */
+        Iterator begin() const {
+            return Iterator(intervals_, runs_.data(), runs_.data() + runs_.size());
+        }
+        /** past-the-end iterator of results */
+        Iterator end() const {
+            return Iterator(intervals_, runs_.data() + runs_.size(), runs_.data() + runs_.size());
+        }
+        /** number of hits, computed in O(number of runs) */
+        size_t size() const {
+            size_t n = 0;
+            for (const Run &run : runs_) {
+                n += run.size();
+            }
+            return n;
+        }
+        bool empty() const {
+            return runs_.empty();
+        }
+        /** the runs themselves, none of them empty */
+        const std::vector<Run> &runs() const {
+            return runs_;
+        }
+    private:
+        explicit IntervalTreeRuns(const std::vector<value_type> &intervals) : intervals_(&intervals) {}
+        const std::vector<value_type> *intervals_;
+        std::vector<Run> runs_;
+};
+
+//incremental cursor
+
+template <typename T, typename V>
+class StabbingCursor {
+    public:
+        using value_type = typename IntervalTreeEntry<T, V>::type;
+
+        /**
+         * Create a cursor positioned before every interval, so that nothing is active
+         * @param tree tree to sweep; must outlive the cursor and stay unchanged
+         */
+        explicit StabbingCursor(const IntervalTree<T, V> &tree) : tree_(tree), slot_(tree.intervals_.size(), inactive) {
+            if (tree.decision_.layout == IntervalTreeLayout::Flat) {
+                //small collections keep no end order of their own
+                flat_by_end_ = tree.index_sorted_by_start_;
+                std::sort(flat_by_end_.begin(), flat_by_end_.end(), IntervalComp<T, V>(tree.intervals_, false));
+            }
+        }
+
+        /**
+         * Move the cursor to t, updating the active set to the intervals containing t. Costs time proportional to the
+         * number of intervals starting or ending between the previous position and t; moving backwards is allowed.
+         * @param t new position
+         */
+        void advance(T t) {
+            const auto &intervals = tree_.intervals_;
+            const auto &by_start = tree_.index_sorted_by_start_;
+            const auto &by_end = end_order();
+            auto start_at = [&](size_t i) { return IntervalTree<T, V>::interval_of(intervals[by_start[i]]).start; };
+            auto end_at = [&](size_t i) { return IntervalTree<T, V>::interval_of(intervals[by_end[i]]).end; };
+            //the first position can be anywhere, so it is found by a plain search instead of galloping from the front
+            size_t new_start_pos = positioned_ ?
+                    IntervalTree<T, V>::template gallop_bound<true>(by_start.size(), start_pos_, t, start_at) :
+                    tree_.template start_bound<true>(t);
+            size_t new_end_pos = positioned_ ?
+                    IntervalTree<T, V>::template gallop_bound<true>(by_end.size(), end_pos_, t, end_at) :
+                    std::upper_bound(by_end.begin(), by_end.end(), t,
+                                     [&](T v, uint32_t i) {
+                                         return v < IntervalTree<T, V>::interval_of(intervals[i]).end;
+                                     }) - by_end.begin();
+            entered_.clear();
+            left_.clear();
+            if (!positioned_ || !(t < t_)) {
+                //intervals ending in (t_, t] were active unless they also started in that range
+                for (size_t i = end_pos_; i < new_end_pos; i++) {
+                    deactivate(by_end[i]);
+                }
+                for (size_t i = start_pos_; i < new_start_pos; i++) {
+                    if (IntervalTree<T, V>::interval_of(intervals[by_start[i]]).end > t) {
+                        activate(by_start[i]);
+                    }
+                }
+            } else {
+                for (size_t i = new_start_pos; i < start_pos_; i++) {
+                    deactivate(by_start[i]);
+                }
+                for (size_t i = new_end_pos; i < end_pos_; i++) {
+                    if (IntervalTree<T, V>::interval_of(intervals[by_end[i]]).start <= t) {
+                        activate(by_end[i]);
+                    }
+                }
+            }
+            start_pos_ = new_start_pos;
+            end_pos_ = new_end_pos;
+            t_ = t;
+            positioned_ = true;
+        }
+
+        /** intervals containing the current position but not the previous one */
+        const std::vector<const value_type *> &entered() const {
+            return entered_;
+        }
+        /** intervals containing the previous position but not the current one */
+        const std::vector<const value_type *> &left() const {
+            return left_;
+        }
+        /** all intervals containing the current position, in no particular order */
+        const std::vector<const value_type *> &active() const {
+            return active_;
         }
     private:
-        std::vector<const value_type*> results_;
+        static constexpr size_t inactive = std::numeric_limits<size_t>::max();
+
+        /** indices of the tree's intervals sorted by end */
+        const std::vector<uint32_t> &end_order() const {
+            switch (tree_.decision_.layout) {
+                case IntervalTreeLayout::Tree:
+                    return tree_.index_sorted_by_end_;
+                case IntervalTreeLayout::Disjoint:
+                    //disjoint intervals end in the order they start
+                    return tree_.index_sorted_by_start_;
+                default:
+                    return flat_by_end_;
+            }
+        }
+
+        void activate(size_t index) {
+            const value_type *ptr = &tree_.intervals_[index];
+            slot_[index] = active_.size();
+            active_.push_back(ptr);
+            entered_.push_back(ptr);
+        }
+
+        void deactivate(size_t index) {
+            size_t slot = slot_[index];
+            if (slot == inactive) return;
+            left_.push_back(active_[slot]);
+            active_[slot] = active_.back();
+            slot_[active_[slot] - tree_.intervals_.data()] = slot;
+            active_.pop_back();
+            slot_[index] = inactive;
+        }
+
+        const IntervalTree<T, V> &tree_;
+        /** end order of a tree with the flat layout */
+        std::vector<uint32_t> flat_by_end_;
+        /** position of each interval in active_, or inactive */
+        std::vector<size_t> slot_;
+        std::vector<const value_type *> active_;
+        std::vector<const value_type *> entered_;
+        std::vector<const value_type *> left_;
+        /** number of intervals in the tree's start and end orders with start (end) <= t_ */
+        size_t start_pos_ = 0;
+        size_t end_pos_ = 0;
+        T t_ = T();
+        bool positioned_ = false;
 };
 
+template <typename T, typename V>
+constexpr size_t StabbingCursor<T, V>::inactive;
+
 //underlying structure
 
 template<typename T, typename V>
 struct IntervalTree<T, V>::TreeNode {
-    void sort(const std::vector<std::pair<Interval<T>, V>> &intervals) {
-        if (index_sorted_by_start_.size() < center_.size()) {
-            size_t n = index_sorted_by_start_.size();
-            index_sorted_by_start_.resize(center_.size());
-            index_sorted_by_end_.resize(center_.size());
-            std::iota(index_sorted_by_start_.begin() + n, index_sorted_by_start_.end(), n);
-            std::iota(index_sorted_by_end_.begin() + n, index_sorted_by_end_.end(), n);
-        }
-        std::sort(index_sorted_by_start_.begin(), index_sorted_by_start_.end(), IntervalComp<T, V>(intervals, center_, true));
-        std::sort(index_sorted_by_end_.begin(), index_sorted_by_end_.end(), IntervalComp<T, V>(intervals, center_, false));
-    }
-
     TreeNode() = default;
 
     /**
      * Recursively construct an interval tree rooted at this node
      * @param intervals intervals to distribute among the nodes
+     * @param split rule for choosing the center of each node
      */
-    explicit TreeNode(const std::vector<std::pair<Interval<T>, V>> &intervals, const std::vector<size_t> &indices) {
+    TreeNode(const std::vector<value_type> &intervals, const std::vector<index_type> &indices, IntervalTreeSplit split) {
         T t_min = std::numeric_limits<T>::max();
         T t_max = std::numeric_limits<T>::lowest();
         for (auto index : indices) {
-            t_min = std::min(t_min, intervals[index].first.start);
-            t_max = std::max(t_max, intervals[index].first.end);
+            t_min = std::min(t_min, interval_of(intervals[index]).start);
+            t_max = std::max(t_max, interval_of(intervals[index]).end);
+        }
+        if (split == IntervalTreeSplit::Median) {
+            std::vector<T> endpoints;
+            endpoints.reserve(2 * indices.size());
+            for (auto index : indices) {
+                endpoints.push_back(interval_of(intervals[index]).start);
+                endpoints.push_back(interval_of(intervals[index]).end);
+            }
+            std::nth_element(endpoints.begin(), endpoints.begin() + endpoints.size() / 2, endpoints.end());
+            x_center_ = endpoints[endpoints.size() / 2];
+            //a center in [t_min, t_max) keeps the interval ending at t_max out of the left child and the one
+            //starting at t_min out of the right child, so both children are smaller than this node
+            if (!(t_min <= x_center_ && x_center_ < t_max)) x_center_ = t_min;
+        } else {
+            x_center_ = midpoint(t_min, t_max);
+            if (!(t_min <= x_center_ && x_center_ < t_max)) x_center_ = t_min; //circumvents a numerical issue that leads to infinite depth
         }
-        x_center_ = (t_min + t_max) / 2;
-        if (x_center_ == t_max) x_center_ = t_min; //circumvents a numerical issue that leads to infinite depth
-        std::vector<size_t> left;
-        std::vector<size_t> right;
+        std::vector<index_type> left;
+        std::vector<index_type> right;
+        std::vector<index_type> center;
         for (auto i : indices) {
-            if (intervals[i].first.end <= x_center_) {
+            if (interval_of(intervals[i]).end <= x_center_) {
                 left.push_back(i);
-            } else if (intervals[i].first.start > x_center_) {
+            } else if (interval_of(intervals[i]).start > x_center_) {
                 right.push_back(i);
             } else {
-                center_.push_back(i);
+                center.push_back(i);
             }
         }
-        sort(intervals);
+        center_indices_.reserve(2 * center.size());
+        std::sort(center.begin(), center.end(), IntervalComp<T, V>(intervals, true));
+        center_indices_.insert(center_indices_.end(), center.begin(), center.end());
+        std::sort(center.begin(), center.end(), IntervalComp<T, V>(intervals, false));
+        center_indices_.insert(center_indices_.end(), center.begin(), center.end());
+        center_keys_.reserve(center_indices_.size());
+        for (size_t i = 0; i < center_indices_.size(); i++) {
+            const Interval<T> &interval = interval_of(intervals[center_indices_[i]]);
+            center_keys_.push_back(i < center.size() ? interval.start : interval.end);
+        }
         if (!left.empty()) {
-            left_ = std::make_unique<TreeNode>(intervals, left);
+            left_ = std::make_unique<TreeNode>(intervals, left, split);
         }
         if (!right.empty()) {
-            right_ = std::make_unique<TreeNode>(intervals, right);
+            right_ = std::make_unique<TreeNode>(intervals, right, split);
         }
     }
 
-    TreeNode(const std::vector<std::pair<Interval<T>, V>> &intervals, size_t index) {
-        x_center_ = (intervals[index].first.start + intervals[index].first.end) / 2;
-        if (x_center_ == intervals[index].first.end) x_center_ = intervals[index].first.start;
-        center_.push_back(index);
-        index_sorted_by_start_.push_back(0);
-        index_sorted_by_end_.push_back(0);
+    TreeNode(const std::vector<value_type> &intervals, index_type index) {
+        x_center_ = midpoint(interval_of(intervals[index]).start, interval_of(intervals[index]).end);
+        if (!(interval_of(intervals[index]).start <= x_center_ && x_center_ < interval_of(intervals[index]).end)) {
+            x_center_ = interval_of(intervals[index]).start;
+        }
+        center_indices_ = {index, index};
+        center_keys_ = {interval_of(intervals[index]).start, interval_of(intervals[index]).end};
     }
 
-    void insert(const std::vector<std::pair<Interval<T>, V>> &intervals, size_t index) {
-        if (intervals[index].first.end <= x_center_) {
+    void insert(const std::vector<value_type> &intervals, index_type index) {
+        if (interval_of(intervals[index]).end <= x_center_) {
             if (left_) {
                 left_->insert(intervals, index);
             } else {
                 left_ = std::make_unique<TreeNode>(intervals, index);
             }
-        } else if (intervals[index].first.start > x_center_) {
+        } else if (interval_of(intervals[index]).start > x_center_) {
             if (right_) {
                 right_->insert(intervals, index);
             } else {
                 right_ = std::make_unique<TreeNode>(intervals, index);
             }
         } else {
-            center_.push_back(index);
-            sort(intervals);
+            const Interval<T> &interval = interval_of(intervals[index]);
+            auto middle = center_keys_.begin() + center_size();
+            size_t start_pos = std::upper_bound(center_keys_.begin(), middle, interval.start) - center_keys_.begin();
+            //the end order shifts by one once the start is in place
+            size_t end_pos = std::upper_bound(middle, center_keys_.end(), interval.end) - center_keys_.begin() + 1;
+            center_keys_.insert(center_keys_.begin() + start_pos, interval.start);
+            center_indices_.insert(center_indices_.begin() + start_pos, index);
+            center_keys_.insert(center_keys_.begin() + end_pos, interval.end);
+            center_indices_.insert(center_indices_.begin() + end_pos, index);
+        }
+    }
+
+    /**
+     * number of leading entries of starts() that are <= val
+     * @param hint if not null, the result of a previous call to search from, updated to the new result
+     */
+    size_t count_starts_up_to(T val, size_t *hint = nullptr) const {
+        size_t n;
+        const T *starts = this->starts();
+        size_t size = center_size();
+        if (size <= small_center_size) {
+            n = KeyScan<T>::count_less_equal(starts, size, val);
+        } else if (hint) {
+            n = gallop_bound<true>(size, *hint, val, [&](size_t i) { return starts[i]; });
+        } else {
+            n = std::upper_bound(starts, starts + size, val) - starts;
+        }
+        if (hint) *hint = n;
+        return n;
+    }
+
+    /**
+     * number of trailing entries of ends() that are > val
+     * @param hint if not null, the position of the first such entry found by a previous call, updated to the new one
+     */
+    size_t count_ends_after(T val, size_t *hint = nullptr) const {
+        size_t n;
+        const T *ends = this->ends();
+        size_t size = center_size();
+        if (size <= small_center_size) {
+            n = KeyScan<T>::count_greater(ends, size, val);
+        } else if (hint) {
+            n = size - gallop_bound<true>(size, *hint, val, [&](size_t i) { return ends[i]; });
+        } else {
+            n = ends + size - std::upper_bound(ends, ends + size, val);
         }
+        if (hint) *hint = size - n;
+        return n;
     }
 
-    void query(const std::vector<std::pair<Interval<T>, V>> &intervals, T val, IntervalTreeResult<T, V> &results) const {
+    /**
+     * Report the intervals stored at this node that contain val
+     * @param hint optional search position in this node's center list, see count_starts_up_to()
+     * @return the child to descend into next, or nullptr if the query is finished
+     */
+    template<typename F>
+    const TreeNode *step(T val, F &visit, size_t *hint = nullptr) const {
         if (val <= x_center_) {
-            for (auto it = index_sorted_by_start_.begin(); it != index_sorted_by_start_.end(); it++) {
-                if (intervals[center_[*it]].first.start <= val) {
-                    results.results_.push_back(&intervals[center_[*it]]);
-                } else {
-                    break;
-                }
+            //every interval here ends after x_center_, so the hits are exactly those starting at or before val
+            size_t n = count_starts_up_to(val, hint);
+            const index_type *by_start = sorted_by_start();
+            for (size_t i = 0; i < n; i++) {
+                visit(by_start[i]);
             }
-            if (left_) {
-                left_->query(intervals, val, results);
+            return left_.get();
+        } else {
+            //every interval here starts at or before x_center_, so the hits are exactly those ending after val
+            size_t n = count_ends_after(val, hint);
+            const index_type *by_end = sorted_by_end();
+            for (size_t i = center_size() - n; i < center_size(); i++) {
+                visit(by_end[i]);
             }
+            return right_.get();
+        }
+    }
+
+    /**
+     * Like step(), but report the hits as a single run of this node's index lists, by calling emit(first, last)
+     * @return the child to descend into next, or nullptr if the query is finished
+     */
+    template<typename G>
+    const TreeNode *step_runs(T val, G &emit) const {
+        if (val <= x_center_) {
+            size_t n = count_starts_up_to(val);
+            if (n > 0) {
+                emit(sorted_by_start(), sorted_by_start() + n);
+            }
+            return left_.get();
         } else {
-            for (auto it = index_sorted_by_end_.rbegin(); it != index_sorted_by_end_.rend(); it++) {
-                if (intervals[center_[*it]].first.end > val) {
-                    results.results_.push_back(&intervals[center_[*it]]);
-                } else {
-                    break;
-                }
+            size_t n = count_ends_after(val);
+            if (n > 0) {
+                emit(sorted_by_end() + center_size() - n, sorted_by_end() + center_size());
             }
-            if (right_) {
-                right_->query(intervals, val, results);
+            return right_.get();
+        }
+    }
+
+    /**
+     * Like step(), but only report intervals whose summary shares a bit with mask
+     * @return the child to descend into next, or nullptr if the query is finished or no interval below it can match
+     */
+    template<typename F>
+    const TreeNode *step(const std::vector<uint64_t> &summaries, T val, uint64_t mask, F &visit) const {
+        const TreeNode *next;
+        if (val <= x_center_) {
+            visit_summarized(sorted_by_start(), summary_->start_block_masks, 0, count_starts_up_to(val), summaries, mask, visit);
+            next = left_.get();
+        } else {
+            visit_summarized(sorted_by_end(), summary_->end_block_masks, center_size() - count_ends_after(val), center_size(),
+                             summaries, mask, visit);
+            next = right_.get();
+        }
+        return next && (next->summary_->subtree_mask & mask) ? next : nullptr;
+    }
+
+    /** recompute the summary masks of this subtree */
+    void update_summaries(const std::vector<uint64_t> &summaries) {
+        Summary &summary = summary_or_new();
+        compute_block_masks(sorted_by_start(), center_size(), summaries, summary.start_block_masks);
+        compute_block_masks(sorted_by_end(), center_size(), summaries, summary.end_block_masks);
+        summary.subtree_mask = 0;
+        for (uint64_t block_mask : summary.start_block_masks) {
+            summary.subtree_mask |= block_mask;
+        }
+        if (left_) {
+            left_->update_summaries(summaries);
+            summary.subtree_mask |= left_->summary_->subtree_mask;
+        }
+        if (right_) {
+            right_->update_summaries(summaries);
+            summary.subtree_mask |= right_->summary_->subtree_mask;
+        }
+    }
+
+    /** account for the summary of an interval that was just inserted below this node */
+    void add_summary(const std::vector<value_type> &intervals, const std::vector<uint64_t> &summaries, index_type index) {
+        Summary &summary = summary_or_new();
+        summary.subtree_mask |= summaries[index];
+        if (interval_of(intervals[index]).end <= x_center_) {
+            left_->add_summary(intervals, summaries, index);
+        } else if (interval_of(intervals[index]).start > x_center_) {
+            right_->add_summary(intervals, summaries, index);
+        } else {
+            compute_block_masks(sorted_by_start(), center_size(), summaries, summary.start_block_masks);
+            compute_block_masks(sorted_by_end(), center_size(), summaries, summary.end_block_masks);
+        }
+    }
+
+    /** recompute the priority trees of this subtree */
+    void update_priorities(const std::vector<double> &priorities) {
+        Summary &summary = summary_or_new();
+        compute_priority_tree(sorted_by_start(), center_size(), priorities, summary.start_priority_tree);
+        compute_priority_tree(sorted_by_end(), center_size(), priorities, summary.end_priority_tree);
+        if (left_) {
+            left_->update_priorities(priorities);
+        }
+        if (right_) {
+            right_->update_priorities(priorities);
+        }
+    }
+
+    /** recompute the priority trees of the node holding an interval that was just inserted or whose priority changed */
+    void update_priority(const std::vector<value_type> &intervals, const std::vector<double> &priorities,
+                         index_type index) {
+        Summary &summary = summary_or_new();
+        if (interval_of(intervals[index]).end <= x_center_) {
+            left_->update_priority(intervals, priorities, index);
+        } else if (interval_of(intervals[index]).start > x_center_) {
+            right_->update_priority(intervals, priorities, index);
+        } else {
+            compute_priority_tree(sorted_by_start(), center_size(), priorities, summary.start_priority_tree);
+            compute_priority_tree(sorted_by_end(), center_size(), priorities, summary.end_priority_tree);
+        }
+    }
+
+    template<typename F>
+    void query(T val, F &visit) const {
+        for (const TreeNode *node = this; node; node = node->step(val, visit)) {}
+    }
+
+    /**
+     * Report every interval in this subtree containing at least one of the sorted points in [first, last) exactly once
+     */
+    template<typename F>
+    void query_any_of(const std::vector<value_type> &intervals, const T *first, const T *last, F &visit) const {
+        //points up to the center hit the intervals starting at or before the largest of them, and points past the
+        //center hit those ending after the smallest of them
+        const T *mid = std::upper_bound(first, last, x_center_);
+        size_t n = 0;
+        if (first != mid) {
+            n = count_starts_up_to(*(mid - 1));
+            for (size_t i = 0; i < n; i++) {
+                visit(sorted_by_start()[i]);
+            }
+        }
+        if (mid != last) {
+            size_t m = count_ends_after(*mid);
+            for (size_t i = center_size() - m; i < center_size(); i++) {
+                index_type index = sorted_by_end()[i];
+                //skip the hits already reported for the points on the left
+                if (first == mid || interval_of(intervals[index]).start > *(mid - 1)) {
+                    visit(index);
+                }
             }
         }
+        if (left_ && first != mid) {
+            left_->query_any_of(intervals, first, mid, visit);
+        }
+        if (right_ && mid != last) {
+            right_->query_any_of(intervals, mid, last, visit);
+        }
+    }
+
+    void collect_stats(IntervalTreeStats &stats, size_t depth) const {
+        stats.node_count++;
+        stats.depth = std::max(stats.depth, depth);
+        stats.max_center_size = std::max(stats.max_center_size, center_size());
+        if (left_) {
+            left_->collect_stats(stats, depth + 1);
+        }
+        if (right_) {
+            right_->collect_stats(stats, depth + 1);
+        }
     }
 
     std::unique_ptr<TreeNode> clone() const {
         auto root = std::make_unique<TreeNode>();
-        root->center_ = center_;
-        root->index_sorted_by_start_ = index_sorted_by_start_;
-        root->index_sorted_by_end_ = index_sorted_by_end_;
+        root->center_indices_ = center_indices_;
+        root->center_keys_ = center_keys_;
+        if (summary_) {
+            root->summary_ = std::make_unique<Summary>(*summary_);
+        }
         root->x_center_ = x_center_;
         if (left_) {
-            root->left_ = std::make_unique<TreeNode>();
             root->left_ = left_->clone();
         }
         if (right_) {
-            root->right_ = std::make_unique<TreeNode>();
             root->right_ = right_->clone();
         }
         return root;
     }
+
+    /** number of intervals containing x_center_ */
+    size_t center_size() const {
+        return center_keys_.size() / 2;
+    }
+    const index_type *sorted_by_start() const {
+        return center_indices_.data();
+    }
+    const index_type *sorted_by_end() const {
+        return center_indices_.data() + center_size();
+    }
+    const T *starts() const {
+        return center_keys_.data();
+    }
+    const T *ends() const {
+        return center_keys_.data() + center_size();
+    }
+
     std::unique_ptr<TreeNode> left_, right_;
-    std::vector<size_t> center_;
-    std::vector<size_t> index_sorted_by_start_;
-    std::vector<size_t> index_sorted_by_end_;
+    /**
+     * indices into the tree's intervals of the intervals containing x_center_, sorted by start in the first half and
+     * by end in the second; both orders share one array so that the many small nodes of sparse data stay small
+     */
+    std::vector<index_type> center_indices_;
+    /** starts and ends of the above in the same order, kept contiguous so scans don't chase indices into the intervals */
+    std::vector<T> center_keys_;
+    /**
+     * summary masks of each block of the center lists and of the whole subtree, and the max-trees over the greatest
+     * priority of each block of the center lists
+     */
+    struct Summary {
+        std::vector<uint64_t> start_block_masks;
+        std::vector<uint64_t> end_block_masks;
+        uint64_t subtree_mask = 0;
+        std::vector<double> start_priority_tree;
+        std::vector<double> end_priority_tree;
+    };
+
+    Summary &summary_or_new() {
+        if (!summary_) {
+            summary_ = std::make_unique<Summary>();
+        }
+        return *summary_;
+    }
+
+    /** allocated once summarize() or prioritize() is called, so that other trees don't pay for them in every node */
+    std::unique_ptr<Summary> summary_;
     T x_center_;
+    /** center lists up to this size are scanned linearly rather than binary searched */
+    static constexpr size_t small_center_size = 64;
 };
 
 template<typename T, typename V>
-typename std::vector<std::pair<Interval<T>, V>>::const_iterator
+typename IntervalTree<T, V>::const_iterator
 IntervalTree<T, V>::cbegin() const {
     return intervals_.cbegin();
 }
 
 template<typename T, typename V>
-typename std::vector<std::pair<Interval<T>, V>>::const_iterator
+typename IntervalTree<T, V>::const_iterator
 IntervalTree<T, V>::cend() const {
     return intervals_.cend();
 }
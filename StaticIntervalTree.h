@@ -0,0 +1,174 @@
+#pragma once
+
+#include "IntervalTree.h"
+
+/**
+ * An immutable interval tree built entirely at compile time from a fixed array of interval-value pairs, for lookup
+ * tables known in advance. A constexpr instance lives in read-only data and needs no startup work or allocation.
+ * The intervals are sorted by start and viewed as an implicit balanced binary search tree, where the middle of every
+ * range of positions is the root of that range and stores the greatest end within it, so queries skip all subtrees
+ * that end before the query point. Intervals are inclusive on the left, exclusive on the right, as in IntervalTree.
+ * @tparam T floating point type used by intervals; must be a literal type
+ * @tparam V stored value type; must be a literal type that is default constructible and copy assignable
+ * @tparam N number of intervals
+ */
+template<typename T, typename V, size_t N>
+class StaticIntervalTree {
+    static_assert(N > 0, "StaticIntervalTree needs at least one interval");
+public:
+    /**
+     * Compute the tree from the given interval-value pairs, where each `Interval(a, b)` represents the half-open
+     * interval [a, b); pairs with b <= a are stored but never match. Sorting takes O(n log n) steps of constant
+     * evaluation, so large tables may need a raised -fconstexpr-ops-limit (GCC) or -fconstexpr-steps (Clang).
+     * @param intervals array of interval-value pairs
+     */
+    constexpr explicit StaticIntervalTree(const std::pair<Interval<T>, V> (&intervals)[N]);
+
+    /**
+     * Number of intervals containing the query point, i.e. those with a <= val < b
+     * @param val query point
+     */
+    constexpr size_t count(T val) const;
+
+    /**
+     * Find the interval with the smallest start containing the query point
+     * @param val query point
+     * @return pointer to its value, or nullptr if no interval contains val
+     */
+    constexpr const V *find(T val) const;
+
+    /**
+     * Call f(const Interval<T> &interval, const V &value) for each interval containing the query point, in order of
+     * increasing start. This is a constant expression whenever f can be called in one.
+     * @param val query point
+     */
+    template<typename F>
+    constexpr void query(T val, F &&f) const;
+
+    constexpr size_t size() const { return N; }
+
+private:
+    /** store the greatest end among positions [lo, hi) at their middle position, and return it */
+    constexpr T build_max_ends(size_t lo, size_t hi);
+
+    /** return the first position in [lo, hi) whose interval contains val, or N if there is none */
+    constexpr size_t find_first(size_t lo, size_t hi, T val) const;
+
+    template<typename F>
+    constexpr void visit(size_t lo, size_t hi, T val, F &f) const;
+
+    /** endpoints and values sorted by start */
+    T starts_[N]{};
+    T ends_[N]{};
+    V values_[N]{};
+    /** greatest end in the implicit subtree rooted at each position */
+    T max_ends_[N]{};
+};
+
+/**
+ * Construct a StaticIntervalTree deducing its parameters, e.g.
+ * `constexpr auto tree = make_static_interval_tree(table);` where table is a constexpr array of interval-value pairs
+ */
+template<typename T, typename V, size_t N>
+constexpr StaticIntervalTree<T, V, N> make_static_interval_tree(const std::pair<Interval<T>, V> (&intervals)[N]) {
+    return StaticIntervalTree<T, V, N>(intervals);
+}
+
+/* Definitions */
+
+template<typename T, typename V, size_t N>
+constexpr StaticIntervalTree<T, V, N>::StaticIntervalTree(const std::pair<Interval<T>, V> (&intervals)[N]) {
+    //bottom-up merge sort of the positions by start, stable so that equal starts keep their input order
+    size_t order[N]{};
+    size_t merged[N]{};
+    for (size_t i = 0; i < N; i++) {
+        order[i] = i;
+    }
+    for (size_t width = 1; width < N; width *= 2) {
+        for (size_t lo = 0; lo < N; lo += 2 * width) {
+            size_t mid = std::min(lo + width, N);
+            size_t hi = std::min(lo + 2 * width, N);
+            size_t a = lo;
+            size_t b = mid;
+            for (size_t out = lo; out < hi; out++) {
+                if (b == hi || (a < mid && !(intervals[order[b]].first.start < intervals[order[a]].first.start))) {
+                    merged[out] = order[a++];
+                } else {
+                    merged[out] = order[b++];
+                }
+            }
+        }
+        for (size_t i = 0; i < N; i++) {
+            order[i] = merged[i];
+        }
+    }
+    for (size_t i = 0; i < N; i++) {
+        starts_[i] = intervals[order[i]].first.start;
+        ends_[i] = intervals[order[i]].first.end;
+        values_[i] = intervals[order[i]].second;
+    }
+    build_max_ends(0, N);
+}
+
+template<typename T, typename V, size_t N>
+constexpr T StaticIntervalTree<T, V, N>::build_max_ends(size_t lo, size_t hi) {
+    if (lo >= hi) return std::numeric_limits<T>::lowest();
+    size_t mid = lo + (hi - lo) / 2;
+    T max_end = std::max(ends_[mid], std::max(build_max_ends(lo, mid), build_max_ends(mid + 1, hi)));
+    max_ends_[mid] = max_end;
+    return max_end;
+}
+
+template<typename T, typename V, size_t N>
+constexpr size_t StaticIntervalTree<T, V, N>::find_first(size_t lo, size_t hi, T val) const {
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (!(val < max_ends_[mid])) return N;
+        size_t left = find_first(lo, mid, val);
+        if (left != N) return left;
+        //everything right of mid starts at or after starts_[mid]
+        if (val < starts_[mid]) return N;
+        if (val < ends_[mid]) return mid;
+        lo = mid + 1;
+    }
+    return N;
+}
+
+template<typename T, typename V, size_t N>
+template<typename F>
+constexpr void StaticIntervalTree<T, V, N>::visit(size_t lo, size_t hi, T val, F &f) const {
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (!(val < max_ends_[mid])) return;
+        visit(lo, mid, val, f);
+        if (val < starts_[mid]) return;
+        if (val < ends_[mid]) {
+            f(Interval<T>(starts_[mid], ends_[mid]), values_[mid]);
+        }
+        lo = mid + 1;
+    }
+}
+
+template<typename T, typename V, size_t N>
+constexpr size_t StaticIntervalTree<T, V, N>::count(T val) const {
+    size_t result = 0;
+    //a function object rather than a lambda, which cannot appear in constant expressions before C++17
+    struct Counter {
+        size_t &count;
+        constexpr void operator()(const Interval<T> &, const V &) const { count++; }
+    } counter{result};
+    visit(0, N, val, counter);
+    return result;
+}
+
+template<typename T, typename V, size_t N>
+constexpr const V *StaticIntervalTree<T, V, N>::find(T val) const {
+    size_t index = find_first(0, N, val);
+    return index == N ? nullptr : &values_[index];
+}
+
+template<typename T, typename V, size_t N>
+template<typename F>
+constexpr void StaticIntervalTree<T, V, N>::query(T val, F &&f) const {
+    visit(0, N, val, f);
+}
@@ -0,0 +1,373 @@
+// Latency regression gate. Times build, query(T), the range query and insert on the same fixed workloads, pinned to
+// one CPU, and compares the fastest of several repetitions of each case with a checked-in baseline. Every case is
+// measured relative to a calibration loop of sorting and binary searching that doesn't use the tree, timed alongside
+// the cases and stored in the baseline, so a baseline recorded on one machine carries over to another.
+// Usage: bench [--record] [--baseline FILE] [--threshold RATIO] [--repetitions N] [--cpu N]
+// The exit status is nonzero if any case is slower than its baseline times the threshold. With --record, the current
+// timings are written as the new baseline instead.
+
+#include "IntervalTree.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+namespace {
+
+/** keeps the results of the timed loops observable, so they are not optimized away */
+volatile size_t sink = 0;
+
+template<typename T>
+struct Workload {
+    std::string name;
+    std::vector<std::pair<Interval<T>, int>> intervals;
+    /** inserted into a copy of the built tree */
+    std::vector<std::pair<Interval<T>, int>> inserts;
+    std::vector<T> points;
+    std::vector<Interval<T>> windows;
+};
+
+/** one timed case, in nanoseconds per operation */
+struct Result {
+    std::string name;
+    double nanoseconds;
+};
+
+/** uniformly placed intervals of moderate length, the common case */
+Workload<double> uniform_workload() {
+    Workload<double> workload;
+    workload.name = "uniform";
+    std::mt19937_64 rng(1);
+    std::uniform_real_distribution<double> start(0, 1e6);
+    std::uniform_real_distribution<double> length(0, 1000);
+    auto make = [&]() {
+        double a = start(rng);
+        return Interval<double>(a, a + length(rng));
+    };
+    for (int i = 0; i < 200000; i++) {
+        workload.intervals.emplace_back(make(), i);
+    }
+    for (int i = 0; i < 2000; i++) {
+        workload.inserts.emplace_back(make(), i);
+    }
+    for (int i = 0; i < 100000; i++) {
+        workload.points.push_back(start(rng));
+    }
+    for (int i = 0; i < 20000; i++) {
+        double a = start(rng);
+        workload.windows.emplace_back(a, a + length(rng));
+    }
+    return workload;
+}
+
+/** intervals around a common center, which all land in few nodes and make every query return many hits */
+Workload<double> nested_workload() {
+    Workload<double> workload;
+    workload.name = "nested";
+    std::mt19937_64 rng(2);
+    std::uniform_real_distribution<double> radius(0, 1e5);
+    std::uniform_real_distribution<double> point(-1e5, 1e5);
+    auto make = [&]() {
+        double r = radius(rng);
+        return Interval<double>(-r, r + 1);
+    };
+    for (int i = 0; i < 50000; i++) {
+        workload.intervals.emplace_back(make(), i);
+    }
+    for (int i = 0; i < 500; i++) {
+        workload.inserts.emplace_back(make(), i);
+    }
+    for (int i = 0; i < 2000; i++) {
+        workload.points.push_back(point(rng));
+    }
+    for (int i = 0; i < 1000; i++) {
+        double a = point(rng);
+        workload.windows.emplace_back(a, a + 100);
+    }
+    return workload;
+}
+
+/** short integer intervals spread thinly over a large range, as in genomic coordinates */
+Workload<int> sparse_workload() {
+    Workload<int> workload;
+    workload.name = "sparse";
+    std::mt19937_64 rng(3);
+    std::uniform_int_distribution<int> start(0, 1000000000);
+    std::uniform_int_distribution<int> length(1, 1000);
+    auto make = [&]() {
+        int a = start(rng);
+        return Interval<int>(a, a + length(rng));
+    };
+    for (int i = 0; i < 200000; i++) {
+        workload.intervals.emplace_back(make(), i);
+    }
+    for (int i = 0; i < 2000; i++) {
+        workload.inserts.emplace_back(make(), i);
+    }
+    for (int i = 0; i < 100000; i++) {
+        workload.points.push_back(start(rng));
+    }
+    for (int i = 0; i < 20000; i++) {
+        int a = start(rng);
+        workload.windows.emplace_back(a, a + 100000);
+    }
+    return workload;
+}
+
+/** one operation measured over a batch: setup() runs untimed before every run(), which performs operations of them */
+struct Case {
+    std::string name;
+    size_t operations;
+    std::function<void()> setup;
+    std::function<void()> run;
+};
+
+/** name of the calibration case, which the baseline stores apart from the others */
+const char *const calibration_name = "calibration";
+
+/**
+ * Sorting and binary searching plain arrays, the two costs that dominate building and querying a tree, so that it
+ * scales with the machine's speed in roughly the same way as the cases do
+ */
+void add_calibration(std::vector<Case> &cases) {
+    auto keys = std::make_shared<std::vector<double>>();
+    auto probes = std::make_shared<std::vector<double>>();
+    std::mt19937_64 rng(4);
+    std::uniform_real_distribution<double> key(0, 1e6);
+    for (int i = 0; i < 200000; i++) {
+        keys->push_back(key(rng));
+    }
+    for (int i = 0; i < 100000; i++) {
+        probes->push_back(key(rng));
+    }
+    auto sorted = std::make_shared<std::vector<double>>();
+    cases.push_back({calibration_name, 1, [keys, sorted]() { *sorted = *keys; }, [probes, sorted]() {
+        std::sort(sorted->begin(), sorted->end());
+        size_t positions = 0;
+        for (double probe : *probes) {
+            positions += std::upper_bound(sorted->begin(), sorted->end(), probe) - sorted->begin();
+        }
+        sink = sink + positions;
+    }});
+}
+
+template<typename T>
+void add_cases(std::shared_ptr<const Workload<T>> workload, std::vector<Case> &cases) {
+    auto tree = std::make_shared<IntervalTree<T, int>>(workload->intervals.begin(), workload->intervals.end());
+    auto built = std::make_shared<IntervalTree<T, int>>();
+    cases.push_back({workload->name + "/build", workload->intervals.size(), [built]() { built->clear(); },
+        [workload, built]() { built->build(workload->intervals.begin(), workload->intervals.end()); }});
+    cases.push_back({workload->name + "/query_point", workload->points.size(), []() {}, [workload, tree]() {
+        size_t hits = 0;
+        for (T point : workload->points) {
+            hits += tree->query(point).size();
+        }
+        sink = sink + hits;
+    }});
+    cases.push_back({workload->name + "/query_range", workload->windows.size(), []() {}, [workload, tree]() {
+        size_t hits = 0;
+        for (const Interval<T> &window : workload->windows) {
+            hits += tree->query(window).size();
+        }
+        sink = sink + hits;
+    }});
+    auto copy = std::make_shared<IntervalTree<T, int>>();
+    cases.push_back({workload->name + "/insert", workload->inserts.size(), [tree, copy]() { *copy = *tree; },
+        [workload, copy]() {
+            for (const auto &pair : workload->inserts) {
+                copy->insert(pair.first, pair.second);
+            }
+        }});
+}
+
+/**
+ * Fastest time per operation of every case over repetitions, after one untimed warm-up round. Each round runs every
+ * case once, so a stretch of interference from the rest of the machine slows one round of all cases rather than every
+ * repetition of one; and since interference only ever adds time, the minimum is far more stable than the mean.
+ */
+std::vector<Result> time_cases(const std::vector<Case> &cases, size_t repetitions) {
+    std::vector<Result> results;
+    for (const Case &c : cases) {
+        results.push_back({c.name, std::numeric_limits<double>::infinity()});
+    }
+    for (size_t round = 0; round <= repetitions; round++) {
+        for (size_t i = 0; i < cases.size(); i++) {
+            cases[i].setup();
+            auto begin = std::chrono::steady_clock::now();
+            cases[i].run();
+            std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - begin;
+            if (round > 0) {
+                results[i].nanoseconds = std::min(results[i].nanoseconds,
+                                                  elapsed.count() / static_cast<double>(cases[i].operations));
+            }
+        }
+    }
+    return results;
+}
+
+/** pin the process to one CPU so that timings don't include migrations; a negative cpu picks the last one allowed */
+bool pin_to_cpu(int cpu) {
+#ifdef __linux__
+    cpu_set_t set;
+    if (cpu < 0) {
+        CPU_ZERO(&set);
+        if (sched_getaffinity(0, sizeof(set), &set) != 0) return false;
+        for (int i = 0; i < CPU_SETSIZE; i++) {
+            if (CPU_ISSET(i, &set)) cpu = i;
+        }
+        if (cpu < 0) return false;
+    }
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return sched_setaffinity(0, sizeof(set), &set) == 0;
+#else
+    (void)cpu;
+    return false;
+#endif
+}
+
+/** read the "case": nanoseconds entries of a baseline written by write_baseline(), including the calibration */
+bool read_baseline(const std::string &path, std::vector<Result> &baseline) {
+    std::ifstream in(path);
+    if (!in) return false;
+    std::stringstream contents;
+    contents << in.rdbuf();
+    std::string text = contents.str();
+    for (size_t open = text.find('"'); open != std::string::npos; open = text.find('"', open + 1)) {
+        size_t close = text.find('"', open + 1);
+        if (close == std::string::npos) break;
+        size_t colon = text.find_first_not_of(" \t\r\n", close + 1);
+        if (colon != std::string::npos && text[colon] == ':') {
+            const char *value = text.c_str() + colon + 1;
+            char *end;
+            double nanoseconds = std::strtod(value, &end);
+            //keys with string or object values, like "unit" and "cases", are skipped
+            if (end != value) {
+                baseline.push_back({text.substr(open + 1, close - open - 1), nanoseconds});
+            }
+        }
+        open = close;
+    }
+    return true;
+}
+
+/** the result with the given name, or nullptr */
+const Result *find_result(const std::vector<Result> &results, const std::string &name) {
+    auto match = std::find_if(results.begin(), results.end(), [&](const Result &r) { return r.name == name; });
+    return match != results.end() ? &*match : nullptr;
+}
+
+bool write_baseline(const std::string &path, const std::vector<Result> &results) {
+    std::ofstream out(path);
+    out << "{\n    \"unit\": \"nanoseconds per operation, fastest of repetitions; compared relative to the calibration\""
+        << ",\n" << std::fixed << std::setprecision(1);
+    out << "    \"" << calibration_name << "\": " << find_result(results, calibration_name)->nanoseconds << ",\n";
+    out << "    \"cases\": {\n";
+    std::vector<Result> cases;
+    std::copy_if(results.begin(), results.end(), std::back_inserter(cases),
+                 [](const Result &r) { return r.name != calibration_name; });
+    for (size_t i = 0; i < cases.size(); i++) {
+        out << "        \"" << cases[i].name << "\": " << cases[i].nanoseconds << (i + 1 < cases.size() ? ",\n" : "\n");
+    }
+    out << "    }\n}\n";
+    return static_cast<bool>(out);
+}
+
+}
+
+int main(int argc, char **argv) {
+    std::string baseline_path = "bench_baseline.json";
+    double threshold = 1.25;
+    size_t repetitions = 7;
+    int cpu = -1;
+    bool record = false;
+    for (int i = 1; i < argc; i++) {
+        bool has_value = i + 1 < argc;
+        if (!std::strcmp(argv[i], "--record")) {
+            record = true;
+        } else if (!std::strcmp(argv[i], "--baseline") && has_value) {
+            baseline_path = argv[++i];
+        } else if (!std::strcmp(argv[i], "--threshold") && has_value) {
+            threshold = std::strtod(argv[++i], nullptr);
+        } else if (!std::strcmp(argv[i], "--repetitions") && has_value) {
+            repetitions = std::max<size_t>(1, std::strtoul(argv[++i], nullptr, 10));
+        } else if (!std::strcmp(argv[i], "--cpu") && has_value) {
+            cpu = std::atoi(argv[++i]);
+        } else {
+            std::cerr << "usage: " << argv[0]
+                      << " [--record] [--baseline FILE] [--threshold RATIO] [--repetitions N] [--cpu N]" << std::endl;
+            return 2;
+        }
+    }
+    std::vector<Result> baseline;
+    if (!record && !read_baseline(baseline_path, baseline)) {
+        std::cerr << "could not read " << baseline_path << "; run with --record to create it" << std::endl;
+        return 2;
+    }
+    if (!pin_to_cpu(cpu)) {
+        std::cerr << "warning: could not pin to a CPU, timings may be noisy" << std::endl;
+    }
+
+    std::vector<Case> cases;
+    add_calibration(cases);
+    add_cases(std::make_shared<const Workload<double>>(uniform_workload()), cases);
+    add_cases(std::make_shared<const Workload<double>>(nested_workload()), cases);
+    add_cases(std::make_shared<const Workload<int>>(sparse_workload()), cases);
+    std::vector<Result> results = time_cases(cases, repetitions);
+
+    if (record) {
+        if (!write_baseline(baseline_path, results)) {
+            std::cerr << "could not write " << baseline_path << std::endl;
+            return 2;
+        }
+        for (const Result &result : results) {
+            std::cout << std::left << std::setw(24) << result.name << std::right << std::fixed << std::setprecision(1)
+                      << std::setw(12) << result.nanoseconds << " ns" << std::endl;
+        }
+        std::cout << "recorded " << baseline_path << std::endl;
+        return 0;
+    }
+    const Result *baseline_calibration = find_result(baseline, calibration_name);
+    if (!baseline_calibration || !(baseline_calibration->nanoseconds > 0)) {
+        std::cerr << baseline_path << " has no calibration; run with --record to create it" << std::endl;
+        return 2;
+    }
+    //the baseline scaled by how much faster or slower this machine runs the calibration
+    double scale = find_result(results, calibration_name)->nanoseconds / baseline_calibration->nanoseconds;
+    std::cout << "calibration " << std::fixed << std::setprecision(2) << scale << "x the baseline machine's time"
+              << std::endl;
+    size_t regressions = 0;
+    std::cout << std::left << std::setw(24) << "case" << std::right << std::setw(12) << "expected" << std::setw(12)
+              << "current" << std::setw(8) << "ratio" << std::endl;
+    for (const Result &result : results) {
+        if (result.name == calibration_name) continue;
+        const Result *match = find_result(baseline, result.name);
+        std::cout << std::left << std::setw(24) << result.name << std::right << std::fixed << std::setprecision(1);
+        if (!match) {
+            std::cout << std::setw(12) << "-" << std::setw(12) << result.nanoseconds << "  (not in baseline)" << std::endl;
+            continue;
+        }
+        double expected = match->nanoseconds * scale;
+        double ratio = result.nanoseconds / expected;
+        bool regressed = ratio > threshold;
+        regressions += regressed;
+        std::cout << std::setw(12) << expected << std::setw(12) << result.nanoseconds << std::setw(8)
+                  << std::setprecision(2) << ratio << (regressed ? "  SLOWER" : "") << std::endl;
+    }
+    std::cout << regressions << " of " << results.size() - 1 << " cases slower than " << threshold << "x their baseline"
+              << std::endl;
+    return regressions != 0;
+}
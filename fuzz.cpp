@@ -0,0 +1,774 @@
+// Differential fuzz test. Builds trees from random and adversarial interval sets (duplicates, empty and reversed
+// intervals, deep nesting, disjoint runs, equal starts, type limits and infinities), drives them through every public
+// operation and compares every query variant against a brute-force scan of the same intervals. IntervalMap is checked
+// against a replay of its assignments, and a StaticIntervalTree table is checked at compile time and against a scan.
+// Usage: fuzz [rounds] [seed]. The exit status is nonzero if any result differed.
+
+#include "AggregatingIntervalTree.h"
+#include "CompressedIntervalTree.h"
+#include "IntervalBitmap.h"
+#include "IntervalMap.h"
+#include "StaticIntervalTree.h"
+#include <iostream>
+#include <map>
+#include <random>
+#include <string>
+#include <cstdlib>
+
+namespace {
+
+using Id = long long;
+
+/** counts mismatches and describes the first few */
+struct Failures {
+    size_t count = 0;
+
+    void check(bool ok, const std::string &what) {
+        if (ok) return;
+        if (count < 20) {
+            std::cerr << "mismatch: " << what << std::endl;
+        }
+        count++;
+    }
+};
+
+template<typename T>
+std::vector<T> extremes(std::false_type) {
+    const T lowest = std::numeric_limits<T>::lowest();
+    const T max = std::numeric_limits<T>::max();
+    std::vector<T> values = {lowest, T(lowest + 1), T(lowest + 2), T(0), T(1), T(max - 2), T(max - 1), max};
+    if (std::is_signed<T>::value) {
+        values.push_back(T(-1));
+    }
+    return values;
+}
+
+template<typename T>
+std::vector<T> extremes(std::true_type) {
+    const T max = std::numeric_limits<T>::max();
+    const T inf = std::numeric_limits<T>::infinity();
+    const T tiny = std::numeric_limits<T>::denorm_min();
+    const T min = std::numeric_limits<T>::min();
+    return {-inf, -max, -max / 2, T(-1), -min, -tiny, T(-0.0), T(0), tiny, min, T(1), max / 2, max, inf};
+}
+
+/** a + d, saturating at the limits of T */
+template<typename T>
+T offset(T a, int d, std::false_type) {
+    if (d >= 0) {
+        return a > std::numeric_limits<T>::max() - T(d) ? std::numeric_limits<T>::max() : T(a + T(d));
+    }
+    return a < std::numeric_limits<T>::lowest() + T(-d) ? std::numeric_limits<T>::lowest() : T(a - T(-d));
+}
+
+template<typename T>
+T offset(T a, int d, std::true_type) {
+    return a + T(d);
+}
+
+/** the neighbors of a value, where the result of a comparison with an endpoint changes */
+template<typename T>
+T below(T a, std::false_type) {
+    return offset(a, -1, std::false_type());
+}
+
+template<typename T>
+T below(T a, std::true_type) {
+    return std::nextafter(a, -std::numeric_limits<T>::infinity());
+}
+
+template<typename T>
+T above(T a, std::false_type) {
+    return offset(a, 1, std::false_type());
+}
+
+template<typename T>
+T above(T a, std::true_type) {
+    return std::nextafter(a, std::numeric_limits<T>::infinity());
+}
+
+uint64_t summary(Id id) {
+    return uint64_t(1) << (id % 64);
+}
+
+/** the same ranking as the key of query_top_k() in verify(), with many ties */
+template<typename Pair>
+double priority(const Pair &pair) {
+    return static_cast<double>(pair.second % 7);
+}
+
+/** sorted ids, compared as multisets */
+using Ids = std::vector<Id>;
+
+Ids sorted(Ids ids) {
+    std::sort(ids.begin(), ids.end());
+    return ids;
+}
+
+template<typename Range>
+Ids ids(const Range &range) {
+    Ids result;
+    for (const auto &pair : range) {
+        result.push_back(pair.second);
+    }
+    return sorted(result);
+}
+
+
+template<typename T>
+class Fuzzer {
+public:
+    using Pair = std::pair<Interval<T>, Id>;
+    using Tree = IntervalTree<T, Id>;
+
+    Fuzzer(const std::string &type_name, uint64_t seed, Failures &failures) :
+            type_name_(type_name), rng_(seed), failures_(failures) {}
+
+    void run(size_t round);
+
+private:
+    using is_floating = std::is_floating_point<T>;
+
+    enum Shape {
+        Random,
+        Duplicates,
+        Nested,
+        Disjoint,
+        EqualStarts,
+        Extremes,
+        shape_count
+    };
+
+    enum Scale {
+        Small,
+        Wide,
+        Limits
+    };
+
+    T coordinate();
+    Interval<T> make_interval(size_t i);
+    std::vector<T> make_probes(const std::vector<Pair> &pairs);
+
+    static bool contains(const Interval<T> &interval, T val) {
+        return interval.start <= val && val < interval.end;
+    }
+    static bool overlaps(const Interval<T> &interval, const Interval<T> &window) {
+        if (!(interval.start < interval.end)) return false;
+        if (window.start < window.end) return interval.start < window.end && window.start < interval.end;
+        return contains(interval, window.start);
+    }
+    /** ids of the pairs overlapping window, or containing its start if it is empty */
+    static Ids expected(const std::vector<Pair> &pairs, const Interval<T> &window);
+    static Ids expected_any_of(const std::vector<Pair> &pairs, const std::vector<T> &points);
+
+    void check(bool ok, const char *stage, const char *what) {
+        failures_.check(ok, type_name_ + " round " + std::to_string(round_) + ", " + stage + ": " + what);
+    }
+
+    /** compare every query of the tree against a scan of pairs, which must mirror its storage order */
+    void verify(const Tree &tree, const std::vector<Pair> &pairs, const char *stage);
+    void verify_cursor(const Tree &tree, const std::vector<Pair> &pairs);
+    void verify_aggregates(const std::vector<Pair> &pairs, BuildPolicy policy);
+    void verify_compressed(const std::vector<Pair> &pairs);
+    /** build an IntervalTree<T, void> from the intervals of pairs, partly by insertion, and compare its queries */
+    void verify_set(const std::vector<Pair> &pairs, BuildPolicy policy);
+    /** apply random assignments and erasures to an IntervalMap and compare it with replaying them backwards */
+    void verify_map();
+
+    std::string type_name_;
+    std::mt19937_64 rng_;
+    Failures &failures_;
+    size_t round_ = 0;
+    Shape shape_ = Random;
+    Scale scale_ = Small;
+    /** shared point of the nested, disjoint and equal start shapes */
+    T base_ = T(0);
+    bool summarized_ = false;
+    bool prioritized_ = false;
+    Id next_id_ = 0;
+    std::vector<Pair> pairs_;
+};
+
+template<typename T>
+T Fuzzer<T>::coordinate() {
+    if (scale_ == Limits && rng_() % 4 != 0) {
+        std::vector<T> values = extremes<T>(is_floating());
+        return values[rng_() % values.size()];
+    }
+    if (scale_ == Wide) {
+        if (is_floating::value) {
+            double mantissa = static_cast<double>(rng_() % 1000 + 1);
+            double magnitude = std::ldexp(mantissa, static_cast<int>(rng_() % 80) - 40);
+            return static_cast<T>(rng_() % 2 ? magnitude : -magnitude);
+        }
+        return static_cast<T>(std::uniform_int_distribution<long long>(
+                static_cast<long long>(std::numeric_limits<T>::lowest() / 2),
+                static_cast<long long>(std::numeric_limits<T>::max() / 2))(rng_));
+    }
+    T value = offset(std::is_signed<T>::value ? T(-100) : T(0), static_cast<int>(rng_() % 200), is_floating());
+    return is_floating::value && rng_() % 2 ? static_cast<T>(value + T(0.5)) : value;
+}
+
+template<typename T>
+Interval<T> Fuzzer<T>::make_interval(size_t i) {
+    int length = static_cast<int>(rng_() % 60);
+    if (rng_() % 8 == 0) {
+        //empty and reversed intervals, which no query returns
+        length = -static_cast<int>(rng_() % 3);
+    }
+    switch (shape_) {
+        case Duplicates:
+            if (!pairs_.empty() && rng_() % 2) {
+                return pairs_[rng_() % pairs_.size()].first;
+            }
+            break;
+        case Nested: {
+            int radius = static_cast<int>(rng_() % (2 * i + 2));
+            return Interval<T>(offset(base_, -radius, is_floating()), offset(base_, radius + 1, is_floating()));
+        }
+        case Disjoint: {
+            T start = offset(base_, static_cast<int>(4 * i), is_floating());
+            return Interval<T>(start, offset(start, static_cast<int>(rng_() % 4), is_floating()));
+        }
+        case EqualStarts:
+            return Interval<T>(base_, offset(base_, length, is_floating()));
+        case Extremes: {
+            std::vector<T> values = extremes<T>(is_floating());
+            T start = values[rng_() % values.size()];
+            return Interval<T>(start, values[rng_() % values.size()]);
+        }
+        default:
+            break;
+    }
+    T start = coordinate();
+    if (rng_() % 5 == 0) {
+        return Interval<T>(start, coordinate());
+    }
+    return Interval<T>(start, offset(start, length, is_floating()));
+}
+
+template<typename T>
+std::vector<T> Fuzzer<T>::make_probes(const std::vector<Pair> &pairs) {
+    std::vector<T> probes = extremes<T>(is_floating());
+    for (size_t k = 0; k < 8 && !pairs.empty(); k++) {
+        const Interval<T> &interval = pairs[rng_() % pairs.size()].first;
+        for (T endpoint : {interval.start, interval.end}) {
+            probes.push_back(endpoint);
+            probes.push_back(below(endpoint, is_floating()));
+            probes.push_back(above(endpoint, is_floating()));
+        }
+    }
+    for (size_t k = 0; k < 6; k++) {
+        probes.push_back(coordinate());
+    }
+    return probes;
+}
+
+template<typename T>
+Ids Fuzzer<T>::expected(const std::vector<Pair> &pairs, const Interval<T> &window) {
+    Ids result;
+    for (const Pair &pair : pairs) {
+        if (overlaps(pair.first, window)) {
+            result.push_back(pair.second);
+        }
+    }
+    return sorted(result);
+}
+
+template<typename T>
+Ids Fuzzer<T>::expected_any_of(const std::vector<Pair> &pairs, const std::vector<T> &points) {
+    Ids result;
+    for (const Pair &pair : pairs) {
+        bool hit = false;
+        for (T point : points) {
+            hit = hit || contains(pair.first, point);
+        }
+        if (hit) {
+            result.push_back(pair.second);
+        }
+    }
+    return sorted(result);
+}
+
+template<typename T>
+void Fuzzer<T>::verify(const Tree &tree, const std::vector<Pair> &pairs, const char *stage) {
+    check(tree.size() == pairs.size(), stage, "size()");
+    bool same_storage = tree.size() == pairs.size();
+    for (size_t i = 0; same_storage && i < pairs.size(); i++) {
+        const Pair &stored = tree.cbegin()[i];
+        same_storage = stored.first.start == pairs[i].first.start && stored.first.end == pairs[i].first.end &&
+                       stored.second == pairs[i].second;
+    }
+    check(same_storage, stage, "cbegin()");
+    if (!same_storage) return;
+    auto stored_ids = [&](const std::vector<uint32_t> &indices) {
+        Ids result;
+        for (uint32_t i : indices) {
+            result.push_back(i < pairs.size() ? pairs[i].second : -1);
+        }
+        return sorted(result);
+    };
+    auto bitmap_ids = [&](const IntervalBitmap &bitmap) {
+        std::vector<uint32_t> indices;
+        bitmap.copy(std::back_inserter(indices));
+        return stored_ids(indices);
+    };
+    uint64_t mask = rng_() & rng_() & rng_();
+    auto masked = [&](const Ids &all) {
+        Ids result;
+        for (Id id : all) {
+            //a tree without summaries ignores the mask
+            if (!summarized_ || (summary(id) & mask)) result.push_back(id);
+        }
+        return result;
+    };
+    typename Tree::QueryHint hint;
+    std::vector<T> probes = make_probes(pairs);
+    std::vector<Ids> wanted;
+    for (T val : probes) {
+        Ids want = expected(pairs, Interval<T>(val, val));
+        wanted.push_back(want);
+        check(ids(tree.query(val)) == want, stage, "query(T)");
+        check(ids(tree.template query<0>(val)) == want, stage, "query<0>(T)");
+        check(ids(tree.template query<64>(val)) == want, stage, "query<64>(T)");
+        check(ids(tree.query(val, hint)) == want, stage, "query(T, QueryHint)");
+        check(ids(tree.query(val, mask)) == masked(want), stage, "query(T, mask)");
+        std::vector<uint32_t> indices;
+        tree.query_ids(val, std::back_inserter(indices));
+        check(stored_ids(indices) == want, stage, "query_ids(T)");
+        check(bitmap_ids(query_bitmap(tree, val)) == want, stage, "query_bitmap(T)");
+        auto runs = tree.query_runs(val);
+        size_t run_total = 0;
+        for (const auto &run : runs.runs()) {
+            run_total += run.size();
+            check(run.size() > 0, stage, "query_runs(T) empty run");
+        }
+        check(ids(runs) == want && runs.size() == want.size() && run_total == want.size() && runs.empty() == want.empty(),
+              stage, "query_runs(T)");
+        size_t k = rng_() % 6;
+        auto key = [](const Pair &pair) { return pair.second % 7; };
+        std::vector<Id> want_keys;
+        for (Id id : want) {
+            want_keys.push_back(id % 7);
+        }
+        std::sort(want_keys.rbegin(), want_keys.rend());
+        want_keys.resize(std::min(k, want_keys.size()));
+        std::vector<Id> keys;
+        for (const Pair &pair : tree.query_top_k(val, k, key)) {
+            keys.push_back(key(pair));
+        }
+        check(keys == want_keys, stage, "query_top_k(T)");
+        keys.clear();
+        Ids top;
+        for (const Pair &pair : tree.query_top_k(val, k)) {
+            keys.push_back(key(pair));
+            top.push_back(pair.second);
+        }
+        if (prioritized_) {
+            check(keys == want_keys, stage, "query_top_k(T) prioritized");
+        } else {
+            //without priorities, any k hits will do
+            top = sorted(top);
+            check(top.size() == want_keys.size() && std::includes(want.begin(), want.end(), top.begin(), top.end()),
+                  stage, "query_top_k(T) unprioritized");
+        }
+    }
+    std::vector<Ids> batch(probes.size());
+    tree.query_batch(probes.begin(), probes.end(), [&](size_t i, const Pair &pair) { batch[i].push_back(pair.second); });
+    std::transform(batch.begin(), batch.end(), batch.begin(), sorted);
+    check(batch == wanted, stage, "query_batch(T)");
+    for (size_t k = 0; k < 6; k++) {
+        std::vector<T> points;
+        for (size_t count = rng_() % 20; points.size() < count;) {
+            points.push_back(probes[rng_() % probes.size()]);
+        }
+        check(ids(tree.query_any_of(points.begin(), points.end())) == expected_any_of(pairs, points), stage, "query_any_of()");
+    }
+    //windows between any two probes, so reversed and empty windows are included
+    std::vector<Interval<T>> windows;
+    std::vector<Ids> window_wanted;
+    for (size_t k = 0; k < 20; k++) {
+        T start = probes[rng_() % probes.size()];
+        Interval<T> window(start, probes[rng_() % probes.size()]);
+        Ids want = expected(pairs, window);
+        windows.push_back(window);
+        window_wanted.push_back(want);
+        check(ids(tree.query(window)) == want, stage, "query(Interval)");
+        check(ids(tree.template query<64>(window)) == want, stage, "query<64>(Interval)");
+        check(ids(tree.query(window, hint)) == want, stage, "query(Interval, QueryHint)");
+        check(ids(tree.query(window, mask)) == masked(want), stage, "query(Interval, mask)");
+        std::vector<uint32_t> indices;
+        tree.query_ids(window, std::back_inserter(indices));
+        check(stored_ids(indices) == want, stage, "query_ids(Interval)");
+        check(bitmap_ids(query_bitmap(tree, window)) == want, stage, "query_bitmap(Interval)");
+        auto runs = tree.query_runs(window);
+        check(ids(runs) == want && runs.size() == want.size() && runs.empty() == want.empty(), stage, "query_runs(Interval)");
+    }
+    std::vector<Ids> window_batch(windows.size());
+    tree.query_batch(windows.begin(), windows.end(), [&](size_t i, const Pair &pair) { window_batch[i].push_back(pair.second); });
+    std::transform(window_batch.begin(), window_batch.end(), window_batch.begin(), sorted);
+    check(window_batch == window_wanted, stage, "query_batch(Interval)");
+    for (size_t k = 0; k < 50 && !pairs.empty(); k++) {
+        //find() returns the first stored interval with the same endpoints
+        const Pair &pair = pairs[rng_() % pairs.size()];
+        auto found = tree.find(pair.first);
+        auto first = std::find_if(pairs.begin(), pairs.end(), [&](const Pair &other) {
+            return other.first.start == pair.first.start && other.first.end == pair.first.end;
+        });
+        check(found - tree.cbegin() == first - pairs.begin(), stage, "find()");
+    }
+}
+
+template<typename T>
+void Fuzzer<T>::verify_cursor(const Tree &tree, const std::vector<Pair> &pairs) {
+    StabbingCursor<T, Id> cursor(tree);
+    std::vector<T> probes = make_probes(pairs);
+    //mostly forward sweeps, with some jumps back
+    std::sort(probes.begin(), probes.end());
+    for (size_t k = 0; k < probes.size() / 8; k++) {
+        std::swap(probes[rng_() % probes.size()], probes[rng_() % probes.size()]);
+    }
+    Ids previous;
+    for (T val : probes) {
+        cursor.advance(val);
+        Ids want = expected(pairs, Interval<T>(val, val));
+        auto pointee_ids = [](const std::vector<const Pair *> &pointers) {
+            Ids result;
+            for (const Pair *pair : pointers) {
+                result.push_back(pair->second);
+            }
+            return sorted(result);
+        };
+        Ids want_entered;
+        Ids want_left;
+        std::set_difference(want.begin(), want.end(), previous.begin(), previous.end(), std::back_inserter(want_entered));
+        std::set_difference(previous.begin(), previous.end(), want.begin(), want.end(), std::back_inserter(want_left));
+        check(pointee_ids(cursor.active()) == want, "cursor", "active()");
+        check(pointee_ids(cursor.entered()) == want_entered, "cursor", "entered()");
+        check(pointee_ids(cursor.left()) == want_left, "cursor", "left()");
+        previous = want;
+    }
+}
+
+template<typename T>
+void Fuzzer<T>::verify_aggregates(const std::vector<Pair> &pairs, BuildPolicy policy) {
+    size_t split = pairs.size() - pairs.size() / 8;
+    AggregatingIntervalTree<T, Id, SumMonoid<Id>> sums(pairs.begin(), pairs.begin() + split, SumMonoid<Id>(), policy);
+    AggregatingIntervalTree<T, Id, MaxMonoid<Id>> maxima;
+    maxima.build(pairs.begin(), pairs.begin() + split, policy);
+    for (size_t i = split; i < pairs.size(); i++) {
+        sums.insert(pairs[i].first, pairs[i].second);
+        maxima.insert(pairs[i].first, pairs[i].second);
+    }
+    auto copy = sums;
+    std::vector<T> probes = make_probes(pairs);
+    for (size_t k = 0; k < probes.size(); k++) {
+        Interval<T> window(probes[k], probes[rng_() % probes.size()]);
+        for (const Interval<T> &query : {Interval<T>(probes[k], probes[k]), window}) {
+            Id sum = 0;
+            Id max = std::numeric_limits<Id>::lowest();
+            for (Id id : expected(pairs, query)) {
+                sum += id;
+                max = std::max(max, id);
+            }
+            //an empty query interval is treated as its start point
+            bool point = !(query.start < query.end);
+            check((point ? copy.aggregate(query.start) : copy.aggregate(query)) == sum, "aggregates", "SumMonoid");
+            check((point ? maxima.aggregate(query.start) : maxima.aggregate(query)) == max, "aggregates", "MaxMonoid");
+        }
+    }
+}
+
+template<typename T>
+void Fuzzer<T>::verify_compressed(const std::vector<Pair> &pairs) {
+    CompressedIntervalTree<T, Id> tree(pairs.begin(), pairs.end());
+    size_t stored = 0;
+    for (const Pair &pair : pairs) {
+        stored += pair.first.start < pair.first.end;
+    }
+    check(tree.size() == stored, "compressed", "size()");
+    std::map<Id, Interval<T>> intervals;
+    for (const Pair &pair : pairs) {
+        intervals.emplace(pair.second, pair.first);
+    }
+    std::vector<T> probes = make_probes(pairs);
+    for (size_t k = 0; k < probes.size(); k++) {
+        Ids hits;
+        auto collect = [&](const Interval<T> &interval, const Id &id) {
+            hits.push_back(id);
+            auto it = intervals.find(id);
+            check(it != intervals.end() && it->second.start == interval.start && it->second.end == interval.end,
+                  "compressed", "endpoints");
+        };
+        Ids want = expected(pairs, Interval<T>(probes[k], probes[k]));
+        tree.query(probes[k], collect);
+        check(sorted(hits) == want && tree.count(probes[k]) == want.size(), "compressed", "query(T)");
+        hits.clear();
+        Interval<T> window(probes[k], probes[rng_() % probes.size()]);
+        tree.query(window, collect);
+        check(sorted(hits) == expected(pairs, window), "compressed", "query(Interval)");
+    }
+}
+
+template<typename T>
+void Fuzzer<T>::verify_set(const std::vector<Pair> &pairs, BuildPolicy policy) {
+    std::vector<Interval<T>> intervals;
+    for (const Pair &pair : pairs) {
+        intervals.push_back(pair.first);
+    }
+    size_t built = rng_() % (intervals.size() + 1);
+    IntervalTree<T, void> tree(intervals.begin(), intervals.begin() + built, policy);
+    for (size_t i = built; i < intervals.size(); i++) {
+        tree.insert(intervals[i]);
+    }
+    check(tree.size() == pairs.size(), "set", "size()");
+    //storage indices follow pairs, so they map back to ids
+    auto ids_of = [&](const std::vector<uint32_t> &indices) {
+        Ids ids;
+        for (uint32_t index : indices) {
+            ids.push_back(pairs[index].second);
+        }
+        return sorted(ids);
+    };
+    std::vector<T> probes = make_probes(pairs);
+    for (size_t k = 0; k < probes.size(); k++) {
+        std::vector<uint32_t> indices;
+        tree.query_ids(probes[k], std::back_inserter(indices));
+        Ids want = expected(pairs, Interval<T>(probes[k], probes[k]));
+        check(ids_of(indices) == want, "set", "query_ids(T)");
+        size_t hits = 0;
+        for (const Interval<T> &interval : tree.query(probes[k])) {
+            hits++;
+            check(contains(interval, probes[k]), "set", "query(T) endpoints");
+        }
+        check(hits == want.size(), "set", "query(T)");
+        Interval<T> window(probes[k], probes[rng_() % probes.size()]);
+        indices.clear();
+        tree.query_ids(window, std::back_inserter(indices));
+        check(ids_of(indices) == expected(pairs, window), "set", "query_ids(Interval)");
+    }
+}
+
+template<typename T>
+void Fuzzer<T>::verify_map() {
+    struct Operation {
+        Interval<T> interval;
+        bool erase;
+        Id value;
+    };
+    IntervalMap<T, Id> map;
+    std::vector<Operation> operations;
+    std::vector<T> probes = make_probes(pairs_);
+    for (size_t count = rng_() % 60, k = 0; k < count; k++) {
+        //few distinct values, so that adjacent segments often have to be merged
+        Operation operation{make_interval(k), rng_() % 4 == 0, static_cast<Id>(rng_() % 3)};
+        if (operation.erase) {
+            map.erase(operation.interval);
+        } else {
+            map.assign(operation.interval, operation.value);
+        }
+        operations.push_back(operation);
+        for (T endpoint : {operation.interval.start, operation.interval.end}) {
+            probes.push_back(endpoint);
+            probes.push_back(below(endpoint, is_floating()));
+        }
+    }
+    for (T val : probes) {
+        //the last operation covering val decides its value
+        const Id *want = nullptr;
+        for (auto it = operations.rbegin(); it != operations.rend(); it++) {
+            if (contains(it->interval, val)) {
+                want = it->erase ? nullptr : &it->value;
+                break;
+            }
+        }
+        const Id *found = map.find(val);
+        check(want ? found && *found == *want : !found, "map", "find()");
+    }
+    bool ordered = true;
+    for (auto it = map.begin(); it != map.end(); it++) {
+        auto next = std::next(it);
+        ordered = ordered && it->first < it->second.end;
+        if (next != map.end()) {
+            //segments are disjoint, and touching ones with equal values are merged
+            ordered = ordered && !(next->first < it->second.end) &&
+                      (it->second.end < next->first || !(it->second.value == next->second.value));
+        }
+    }
+    check(ordered && map.size() == static_cast<size_t>(std::distance(map.begin(), map.end())) &&
+          map.empty() == (map.size() == 0), "map", "segments");
+}
+
+template<typename T>
+void Fuzzer<T>::run(size_t round) {
+    round_ = round;
+    shape_ = static_cast<Shape>(round % shape_count);
+    scale_ = static_cast<Scale>(rng_() % 8 < 5 ? Small : rng_() % 2 ? Wide : Limits);
+    base_ = coordinate();
+    //some rounds pass the size up to which small trees stay flat
+    size_t n = round % 7 == 0 ? 300 + rng_() % 1500 : rng_() % 300;
+    pairs_.clear();
+    for (size_t i = 0; i < n; i++) {
+        Interval<T> interval = make_interval(i);
+        pairs_.emplace_back(interval, next_id_++);
+    }
+    if (rng_() % 2) {
+        std::shuffle(pairs_.begin(), pairs_.end(), rng_);
+    }
+    BuildPolicy policy = static_cast<BuildPolicy>(rng_() % 3);
+    Tree tree(pairs_.begin(), pairs_.end(), policy);
+    summarized_ = rng_() % 3 == 0;
+    if (summarized_) {
+        tree.summarize(summary);
+    }
+    if (rng_() % 4 == 0) {
+        tree.set_learned_index(1 + rng_() % 16);
+    }
+    prioritized_ = rng_() % 2 == 0;
+    if (prioritized_) {
+        tree.prioritize(priority<Pair>);
+    }
+    verify(tree, pairs_, "build");
+
+    for (size_t count = rng_() % 40, i = 0; i < count; i++) {
+        Interval<T> interval = make_interval(n + i);
+        pairs_.emplace_back(interval, next_id_++);
+        tree.insert(interval, pairs_.back().second);
+    }
+    if (!summarized_ && rng_() % 2) {
+        summarized_ = true;
+        tree.summarize(summary);
+    }
+    if (!prioritized_ && rng_() % 2) {
+        prioritized_ = true;
+        tree.prioritize(priority<Pair>);
+    }
+    verify(tree, pairs_, "insert");
+
+    for (size_t k = 0; k < 10; k++) {
+        Interval<T> interval = !pairs_.empty() && rng_() % 3 ? pairs_[rng_() % pairs_.size()].first : make_interval(pairs_.size());
+        auto first = std::find_if(pairs_.begin(), pairs_.end(), [&](const Pair &pair) {
+            return pair.first.start == interval.start && pair.first.end == interval.end;
+        });
+        bool inserted = first == pairs_.end();
+        Id id = next_id_++;
+        auto result = tree.insert_or_assign(interval, id);
+        check(result.second == inserted && result.first->second == id, "modify", "insert_or_assign()");
+        if (inserted) {
+            pairs_.emplace_back(interval, id);
+        } else {
+            first->second = id;
+        }
+        size_t handle = rng_() % pairs_.size();
+        id = next_id_++;
+        tree.modify(tree.cbegin() + handle, [&](Id &value) { value = id; });
+        pairs_[handle].second = id;
+    }
+    verify(tree, pairs_, "modify");
+
+    Tree copy(tree);
+    verify(copy, pairs_, "copy construction");
+    Tree assigned;
+    assigned.insert(make_interval(0), -1);
+    assigned = copy;
+    verify(assigned, pairs_, "copy assignment");
+    Tree moved(std::move(copy));
+    verify(moved, pairs_, "move construction");
+    Tree move_assigned;
+    move_assigned = std::move(assigned);
+    verify(move_assigned, pairs_, "move assignment");
+    //moved-from trees are left empty and stay usable without being cleared first
+    summarized_ = false;
+    prioritized_ = false;
+    verify(copy, std::vector<Pair>(), "moved-from");
+    verify(assigned, std::vector<Pair>(), "moved-from by assignment");
+    std::vector<Pair> refilled(pairs_.begin(), pairs_.begin() + std::min<size_t>(pairs_.size(), rng_() % 400));
+    for (const Pair &pair : refilled) {
+        copy.insert(pair.first, pair.second);
+    }
+    verify(copy, refilled, "insert after move");
+
+    verify_cursor(tree, pairs_);
+    verify_aggregates(pairs_, policy);
+    verify_compressed(pairs_);
+    verify_set(pairs_, policy);
+    verify_map();
+
+    tree.clear();
+    prioritized_ = false;
+    verify(tree, std::vector<Pair>(), "clear");
+    tree.build(pairs_.begin(), pairs_.end(), policy);
+    verify(tree, pairs_, "rebuild");
+}
+
+constexpr std::pair<Interval<int>, int> static_table[] = {
+    {Interval<int>(10, 20), 0}, {Interval<int>(0, 100), 1}, {Interval<int>(15, 15), 2}, {Interval<int>(30, 25), 3},
+    {Interval<int>(10, 12), 4}, {Interval<int>(50, 60), 5}, {Interval<int>(-5, 0), 6}, {Interval<int>(90, 200), 7}
+};
+constexpr auto static_tree = make_static_interval_tree(static_table);
+static_assert(static_tree.count(-6) == 0 && static_tree.count(-5) == 1 && static_tree.count(0) == 1, "");
+//the empty and reversed pairs never match
+static_assert(static_tree.count(10) == 3 && static_tree.count(15) == 2 && static_tree.count(27) == 1, "");
+static_assert(static_tree.count(95) == 2 && static_tree.count(100) == 1 && static_tree.count(200) == 0, "");
+static_assert(*static_tree.find(-5) == 6 && *static_tree.find(10) == 1 && *static_tree.find(150) == 7, "");
+static_assert(static_tree.find(200) == nullptr && static_tree.size() == 8, "");
+
+constexpr double infinity = std::numeric_limits<double>::infinity();
+constexpr std::pair<Interval<double>, int> static_limits_table[] = {
+    {Interval<double>(-infinity, 0.0), 0}, {Interval<double>(0.0, infinity), 1}, {Interval<double>(-1.0, 1.0), 2}
+};
+constexpr auto static_limits_tree = make_static_interval_tree(static_limits_table);
+static_assert(static_limits_tree.count(-infinity) == 1 && static_limits_tree.count(-0.5) == 2, "");
+static_assert(static_limits_tree.count(0.0) == 2 && static_limits_tree.count(infinity) == 0, "");
+static_assert(*static_limits_tree.find(-1.0) == 0 && *static_limits_tree.find(0.5) == 2, "");
+
+/** compare every query of the compile-time table with a scan, at and around all of its endpoints */
+void verify_static(Failures &failures) {
+    for (int val = -10; val <= 210; val++) {
+        std::vector<int> want;
+        for (const auto &pair : static_table) {
+            if (pair.first.start <= val && val < pair.first.end) {
+                want.push_back(pair.second);
+            }
+        }
+        std::vector<int> hits;
+        int last_start = std::numeric_limits<int>::lowest();
+        bool increasing = true;
+        static_tree.query(val, [&](const Interval<int> &interval, const int &value) {
+            increasing = increasing && last_start <= interval.start;
+            last_start = interval.start;
+            hits.push_back(value);
+        });
+        const int *found = static_tree.find(val);
+        //the first hit in start order is the one find() returns
+        bool found_first = hits.empty() ? !found : found && *found == hits.front();
+        std::sort(hits.begin(), hits.end());
+        std::sort(want.begin(), want.end());
+        failures.check(hits == want && increasing && found_first && static_tree.count(val) == want.size(),
+                       "static table at " + std::to_string(val));
+    }
+}
+
+template<typename T>
+void fuzz(const std::string &type_name, size_t rounds, uint64_t seed, Failures &failures) {
+    Fuzzer<T> fuzzer(type_name, seed, failures);
+    for (size_t round = 0; round < rounds; round++) {
+        fuzzer.run(round);
+    }
+}
+
+}
+
+int main(int argc, char **argv) {
+    size_t rounds = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 20;
+    uint64_t seed = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 1;
+    Failures failures;
+    verify_static(failures);
+    fuzz<double>("double", rounds, seed, failures);
+    fuzz<float>("float", rounds, seed, failures);
+    fuzz<int>("int", rounds, seed, failures);
+    fuzz<long long>("long long", rounds, seed, failures);
+    fuzz<unsigned>("unsigned", rounds, seed, failures);
+    std::cout << rounds << " rounds per type with seed " << seed << ": " << failures.count << " mismatches" << std::endl;
+    return failures.count != 0;
+}